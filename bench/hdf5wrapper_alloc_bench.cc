@@ -0,0 +1,92 @@
+#include "HDF5Wrapper.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// hdf5wrapper_alloc_bench: count the heap allocations made by the wrapper
+// itself per call of the path taking entry points. operator new is replaced
+// to count calls, so the allocations of the HDF5 library, made with malloc,
+// are not included. Paths are given as literals and as std::string, dims as
+// initializer lists, which should all be allocation free.
+
+static size_t nalloc = 0;
+
+void *operator new(size_t n)
+{
+    nalloc++;
+    void *p = std::malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+/// number of calls per entry point
+static const int NCALLS = 1000;
+
+static void report(const char *what, size_t n0, size_t n1)
+{
+    printf("%-44s %8.2f\n", what, (double)(n1 - n0) / NCALLS);
+}
+
+int main(int argc, char **argv)
+{
+    std::string filename = argc > 1 ? argv[1] : "hdf5wrapper_alloc_bench.hdf5";
+    H5OutputFile file;
+    file.create(filename);
+
+    double data[30];
+    for (auto i=0;i<30;i++) data[i] = i;
+    char name[32];
+    std::vector<std::string> names;
+    for (auto i=0;i<NCALLS;i++) names.push_back("PartType1/Velocities_" + std::to_string(i));
+    std::string existing = names[NCALLS/2];
+
+    // warm up, creating the groups, so lazily created state is not counted
+    for (auto group : {"Header", "PartType0", "PartType1"}) file.create_dataset(group, "Warm", H5T_NATIVE_DOUBLE, {1});
+    file.write_dataset_nd("Header/Data", {10, 3}, data);
+    file.write_attribute("Header", "Redshift", 0.5);
+    file.create_dataset("Warm", "Data", H5T_NATIVE_DOUBLE, {10});
+
+    size_t n0 = nalloc;
+    for (auto i=0;i<NCALLS;i++) {
+        snprintf(name, sizeof(name), "PartType0/Coordinates_%d", i);
+        file.write_dataset_nd(name, {10, 3}, data);
+    }
+    size_t n1 = nalloc;
+    report("allocs per write_dataset_nd (literal name)", n0, n1);
+
+    n0 = nalloc;
+    for (auto i=0;i<NCALLS;i++) file.write_dataset_nd(names[i], {10, 3}, data);
+    n1 = nalloc;
+    report("allocs per write_dataset_nd (std::string)", n0, n1);
+
+    n0 = nalloc;
+    for (auto i=0;i<NCALLS;i++) {
+        snprintf(name, sizeof(name), "Data_%d", i);
+        file.create_dataset("PartType2/Sub", name, H5T_NATIVE_DOUBLE, {10, 3});
+    }
+    n1 = nalloc;
+    report("allocs per create_dataset", n0, n1);
+
+    n0 = nalloc;
+    for (auto i=0;i<NCALLS;i++) {
+        if (!file.exists_dataset("", existing)) printf("missing dataset %s\n", existing.c_str());
+    }
+    n1 = nalloc;
+    report("allocs per exists_dataset", n0, n1);
+
+    n0 = nalloc;
+    for (auto i=0;i<NCALLS;i++) file.read_from_dataset_nd("Header/Data", data, {}, {});
+    n1 = nalloc;
+    report("allocs per read_from_dataset_nd", n0, n1);
+
+    double redshift = 0;
+    n0 = nalloc;
+    for (auto i=0;i<NCALLS;i++) redshift += file.read_attribute<double>("Header/Redshift");
+    n1 = nalloc;
+    report("allocs per read_attribute", n0, n1);
+
+    file.close();
+    return redshift == 0.5 * NCALLS ? 0 : 1;
+}
@@ -7,6 +7,22 @@ H5OutputFile::H5OutputFile()
 #ifdef USEPARALLELHDF
     parallel_access_id = -1;
 #endif
+    write_statistics = false;
+    statistics_nbins = 0;
+    statistics_histogram_min = statistics_histogram_max = 0;
+    checkpoint_active = false;
+    write_decomposition = false;
+    dedup_active = false;
+    dedup_min_bytes = 0;
+    coalesce_active = false;
+    coalesce_max_bytes = coalesced_bytes = 0;
+    coalesce_max_seconds = 0;
+    swmr_active = swmr_writing = false;
+    swmr_flush_bytes = swmr_pending_bytes = 0;
+    swmr_flush_seconds = 0;
+    // make sure reduced precision types can be converted on read
+    hdf5_register_reduced_precision_types();
+    hdf5_register_delta_filter();
 }
 
 // Destructor closes the file if it's open
@@ -23,6 +39,7 @@ void H5OutputFile::create(std::string filename, hid_t flag,
     MPI_Comm comm = mpi_comm_write;
     MPI_Info info = MPI_INFO_NULL;
     if (iparallelopen && taskID ==-1) {
+        if (swmr_active) io_error("SWMR access is not supported with parallel access");
         parallel_access_id = H5Pcreate (H5P_FILE_ACCESS);
         if (parallel_access_id < 0) io_error("Parallel access creation failed");
         herr_t ret = H5Pset_fapl_mpio(parallel_access_id, comm, info);
@@ -37,7 +54,9 @@ void H5OutputFile::create(std::string filename, hid_t flag,
     else {
         if (taskID <0 || taskID > NProcsWrite) io_error(std::string("MPI Task ID asked to create file out of range. Task ID is ")+to_std::string(taskID));
         if (ThisWriteTask == taskID) {
-            file_id = H5Fcreate(filename.c_str(), flag, H5P_DEFAULT, H5P_DEFAULT);
+            hid_t fapl_id = _file_access_plist();
+            file_id = H5Fcreate(filename.c_str(), flag, H5P_DEFAULT, fapl_id);
+            if (fapl_id != H5P_DEFAULT) H5Pclose(fapl_id);
             if (file_id < 0) io_error(std::string("Failed to create output file: ")+filename);
             parallel_access_id = -1;
         }
@@ -47,7 +66,9 @@ void H5OutputFile::create(std::string filename, hid_t flag,
         MPI_Barrier(comm);
     }
 #else
-    file_id = H5Fcreate(filename.c_str(), flag, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t fapl_id = _file_access_plist();
+    file_id = H5Fcreate(filename.c_str(), flag, H5P_DEFAULT, fapl_id);
+    if (fapl_id != H5P_DEFAULT) H5Pclose(fapl_id);
     if(file_id < 0)io_error(std::string("Failed to create output file: ")+filename);
 #endif
 
@@ -61,6 +82,7 @@ void H5OutputFile::append(std::string filename, hid_t flag,
     MPI_Comm comm = mpi_comm_write;
     MPI_Info info = MPI_INFO_NULL;
     if (iparallelopen && taskID ==-1) {
+        if (swmr_active) io_error("SWMR access is not supported with parallel access");
         parallel_access_id = H5Pcreate (H5P_FILE_ACCESS);
         if (parallel_access_id < 0) io_error("Parallel access creation failed");
         herr_t ret = H5Pset_fapl_mpio(parallel_access_id, comm, info);
@@ -75,7 +97,9 @@ void H5OutputFile::append(std::string filename, hid_t flag,
     else {
         if (taskID <0 || taskID > NProcsWrite) io_error(std::string("MPI Task ID asked to create file out of range. Task ID is ")+to_std::string(taskID));
         if (ThisWriteTask == taskID) {
-            file_id = H5Fopen(filename.c_str(),flag, H5P_DEFAULT);
+            hid_t fapl_id = _file_access_plist();
+            file_id = H5Fopen(filename.c_str(),flag, fapl_id);
+            if (fapl_id != H5P_DEFAULT) H5Pclose(fapl_id);
             if (file_id < 0) io_error(std::string("Failed to create output file: ")+filename);
             parallel_access_id = -1;
         }
@@ -85,7 +109,9 @@ void H5OutputFile::append(std::string filename, hid_t flag,
         MPI_Barrier(comm);
     }
 #else
-    file_id = H5Fopen(filename.c_str(), flag, H5P_DEFAULT);
+    hid_t fapl_id = _file_access_plist();
+    file_id = H5Fopen(filename.c_str(), flag, fapl_id);
+    if (fapl_id != H5P_DEFAULT) H5Pclose(fapl_id);
     if (file_id < 0) io_error(std::string("Failed to create output file: ")+filename);
 #endif
 }
@@ -93,6 +119,7 @@ void H5OutputFile::append(std::string filename, hid_t flag,
 // Close the file
 void H5OutputFile::close()
 {
+    if (file_id >= 0) _flush_coalesced();
 #ifdef USEPARALLELHDF
     if(file_id < 0 && parallel_access_id == -1) io_error("Attempted to close file which is not open!");
     if (parallel_access_id == -1) H5Fclose(file_id);
@@ -104,36 +131,75 @@ void H5OutputFile::close()
 #ifdef USEPARALLELHDF
     parallel_access_id = -1;
 #endif
+    swmr_writing = false;
+    // links can only be made within a file
+    dedup_index.clear();
 }
 
 #ifdef USEPARALLELHDF
 void H5OutputFile::_set_mpi_dim_and_offset(MPI_Comm &comm,
     hsize_t rank, std::vector<hsize_t> &dims,
     std::vector<unsigned long long> &dims_single,
-    std::vector<unsigned long long> &dims_offset
+    std::vector<unsigned long long> &dims_offset,
     std::vector<unsigned long long> &mpi_hdf_dims,
     std::vector<unsigned long long> &mpi_hdf_dims_tot,
     bool flag_parallel, bool flag_first_dim_parallel
     )
+{
+    if (!flag_parallel) return;
+    H5MPIDimExchange exchange;
+    _post_mpi_dim_and_offset(comm, rank, dims.data(), exchange, flag_parallel);
+    _wait_mpi_dim_and_offset(rank, dims.data(), exchange, dims_offset, flag_parallel, flag_first_dim_parallel);
+    dims_single = exchange.dims_single;
+    mpi_hdf_dims = exchange.mpi_hdf_dims;
+    mpi_hdf_dims_tot = exchange.mpi_hdf_dims_tot;
+}
+
+void H5OutputFile::_post_mpi_dim_and_offset(MPI_Comm &comm,
+    hsize_t rank, const hsize_t *dims, H5MPIDimExchange &exchange,
+    bool flag_parallel)
 {
     if (!flag_parallel) return;
     //if parallel hdf5 get the full extent of the data
-    //this bit of code communicating information can probably be done elsewhere
-    //minimize number of mpi communications
-    for (auto i=0;i<rank;i++) dims_single[i]=dims[i];
-    MPI_Allgather(dims_single.data(), rank, MPI_UNSIGNED_LONG_LONG, mpi_hdf_dims.data(), rank, MPI_UNSIGNED_LONG_LONG, comm);
-    MPI_Allreduce(dims_single.data(), mpi_hdf_dims_tot.data(), rank, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+    exchange.dims_single.assign(dims, dims + rank);
+    exchange.mpi_hdf_dims.resize(rank*NProcsWrite);
+    exchange.mpi_hdf_dims_tot.resize(rank);
+    MPI_Iallgather(exchange.dims_single.data(), rank, MPI_UNSIGNED_LONG_LONG,
+        exchange.mpi_hdf_dims.data(), rank, MPI_UNSIGNED_LONG_LONG, comm, &exchange.requests[0]);
+    MPI_Iallreduce(exchange.dims_single.data(), exchange.mpi_hdf_dims_tot.data(), rank,
+        MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm, &exchange.requests[1]);
+    exchange.iposted = true;
+}
+
+void H5OutputFile::_wait_mpi_dim_and_offset(hsize_t rank, const hsize_t *dims,
+    H5MPIDimExchange &exchange, std::vector<unsigned long long> &dims_offset,
+    bool flag_parallel, bool flag_first_dim_parallel)
+{
+    dims_offset.assign(rank, 0);
+    if (!flag_parallel || !exchange.iposted) return;
+    MPI_Waitall(2, exchange.requests, MPI_STATUSES_IGNORE);
+    exchange.iposted = false;
+    // gathered extents are ordered by task, then by dimension
     for (auto i=0;i<rank;i++) {
-        dims_offset[i] = 0;
         if (flag_first_dim_parallel && i > 0) continue;
-        for (auto j=1;j<=ThisWriteTask;j++) {
-            dims_offset[i] += mpi_hdf_dims[i*NProcs+j-1];
+        for (auto j=0;j<ThisWriteTask;j++) {
+            dims_offset[i] += exchange.mpi_hdf_dims[j*rank+i];
         }
     }
     if (flag_first_dim_parallel && rank > 1) {
-        for (auto i=1; i<rank;i++) mpi_hdf_dims_tot[i] = dims[i];
+        for (auto i=1; i<rank;i++) exchange.mpi_hdf_dims_tot[i] = dims[i];
     }
 }
+
+hid_t H5OutputFile::_create_mpi_transfer_properties(bool flag_collective)
+{
+    hid_t prop_id = H5Pcreate(H5P_DATASET_XFER);
+    //if all tasks are participating in the writes
+    if (flag_collective) H5Pset_dxpl_mpio(prop_id, H5FD_MPIO_COLLECTIVE);
+    else H5Pset_dxpl_mpio(prop_id, H5FD_MPIO_INDEPENDENT);
+    return prop_id;
+}
+
 void H5OutputFile::_set_mpi_hyperslab(hid_t &dspace_id, hid_t &memspace_id,
     hsize_t rank, std::vector<hsize_t> &dims,
     std::vector<unsigned long long> &mpi_hdf_dims_tot,
@@ -158,11 +224,8 @@ void H5OutputFile::_set_mpi_dataset_properties(hid_t &prop_id, bool &iwrite,
     bool flag_parallel, bool flag_collective, bool flag_hyperslab)
 {
     if (!flag_parallel) return;
-    // set up the collective transfer properties list
-    prop_id = H5Pcreate(H5P_DATASET_XFER);
-    //if all tasks are participating in the writes
-    if (flag_collective) ret = H5Pset_dxpl_mpio(prop_id, H5FD_MPIO_COLLECTIVE);
-    else ret = H5Pset_dxpl_mpio(prop_id, H5FD_MPIO_INDEPENDENT);
+    // set up the collective transfer properties list unless already made
+    if (prop_id == H5P_DEFAULT) prop_id = _create_mpi_transfer_properties(flag_collective);
     if (flag_hyperslab) {
         H5Sselect_hyperslab(dspace_id, H5S_SELECT_SET, dims_offset.data(), NULL, dims, NULL);
         if (dims[0] == 0) {
@@ -237,6 +300,7 @@ hid_t H5OutputFile::_set_compression(int rank, std::vector<hsize_t> &chunks)
     H5Pset_layout(prop_id, H5D_CHUNKED);
     H5Pset_chunk(prop_id, rank, chunks.data());
     H5Pset_deflate(prop_id, HDFDEFLATE);
+    return prop_id;
 #else
     return H5P_DEFAULT;
 #endif
@@ -308,9 +372,31 @@ void H5OutputFile::_get_attribute(std::vector<hid_t> &ids, const std::vector<std
 void H5OutputFile::get_attribute(std::vector<hid_t> &ids, const std::string &name)
 {
     auto parts = _tokenize(name);
+    // paths are relative to the root of the file
+    if (ids.empty()) ids.push_back(file_id);
     _get_attribute(ids, parts);
 }
 
+hid_t H5OutputFile::_open_attribute(H5PathView name)
+{
+    // the object is the path up to the last '/', the root group if there is none
+    size_t pos = name.size();
+    while (pos > 0 && name[pos-1] != '/') pos--;
+    H5PathView attr_name(name.data() + pos, name.size() - pos);
+    size_t object_len = pos;
+    while (object_len > 1 && name[object_len-1] == '/') object_len--;
+    H5PathBuffer object(object_len > 0 ? H5PathView(name.data(), object_len) : H5PathView("/"));
+    H5PathBuffer attr(attr_name);
+    auto exists = H5Aexists_by_name(file_id, object.c_str(), attr.c_str(), H5P_DEFAULT);
+    if (exists == 0) {
+        throw std::invalid_argument(std::string("attribute not found ") + attr_name);
+    }
+    else if (exists < 0) {
+        throw std::runtime_error("Error on H5Aexists");
+    }
+    return H5Aopen_by_name(file_id, object.c_str(), attr.c_str(), H5P_DEFAULT, H5P_DEFAULT);
+}
+
 /// get a dataset going to list of hids
 void H5OutputFile::_get_dataset(std::vector<hid_t> &ids, const std::string dset_name)
 {
@@ -357,6 +443,8 @@ void H5OutputFile::_get_dataset(std::vector<hid_t> &ids, const std::vector<std::
 void H5OutputFile::get_dataset(std::vector<hid_t> &ids, const std::string &name)
 {
     auto parts = _tokenize(name);
+    // paths are relative to the root of the file
+    if (ids.empty()) ids.push_back(file_id);
     _get_dataset(ids, parts);
 }
 
@@ -406,6 +494,8 @@ void H5OutputFile::_get_hdf5_id(std::vector<hid_t> &ids, const std::vector<std::
 void H5OutputFile::get_hdf5_id(std::vector<hid_t> &ids, const std::string &name)
 {
     auto parts = _tokenize(name);
+    // paths are relative to the root of the file
+    if (ids.empty()) ids.push_back(file_id);
     _get_hdf5_id(ids, parts);
 }
 hid_t H5OutputFile::get_hdf5_id(std::string path, std::string name, bool closeids)
@@ -435,6 +525,7 @@ void H5OutputFile::close_hdf_ids(std::vector<hid_t> &ids)
     H5O_info_t object_info;
     for (auto &id:ids)
     {
+        if (id == file_id) continue;
         hid_t lapl_id = H5P_DEFAULT;
 #if H5_VERSION_GE(1,12,0)
         H5Oget_info(id, &object_info, lapl_id);
@@ -498,32 +589,66 @@ bool H5OutputFile::exists_attribute(const std::string &parent, const std::string
     return exists;
 }
 
-bool H5OutputFile::exists_dataset(const std::string &parent, const std::string &name) {
-    std::string dset_name = parent+std::string("/")+name;
-    std::vector <hid_t> ids;
-    bool exists = true;
-    //groups, data spaces, etc that have been opened.
-    try {
-      get_dataset(ids, dset_name);
+/// check whether every component of a path exists
+bool H5OutputFile::_exists_path(H5PathView name)
+{
+    // check every prefix in turn by ending the copy of the path after it
+    H5PathBuffer path(name);
+    H5PathTokenizer tokens(name);
+    H5PathView token;
+    bool iany = false;
+    while (tokens.next(token)) {
+        char c = path.data()[tokens.end()];
+        path.data()[tokens.end()] = '\0';
+        bool exists = (H5Lexists(file_id, path.c_str(), H5P_DEFAULT) > 0);
+        path.data()[tokens.end()] = c;
+        if (!exists) return false;
+        iany = true;
     }
-    catch (const std::invalid_argument& ia)
-    {
-      exists = false;
+    return iany;
+}
+
+bool H5OutputFile::exists_dataset(H5PathView parent, H5PathView name) {
+    H5PathBuffer dset_name(parent, name);
+    if (!_exists_path(H5PathView(dset_name.c_str(), dset_name.size()))) return false;
+    H5O_info_t object_info;
+    hid_t lapl_id = H5P_DEFAULT;
+#if H5_VERSION_GE(1,12,0)
+    unsigned int fields = H5O_INFO_BASIC;
+    H5Oget_info_by_name(file_id, dset_name.c_str(), &object_info, fields, lapl_id);
+#else
+    H5Oget_info_by_name(file_id, dset_name.c_str(), &object_info, lapl_id);
+#endif
+    return object_info.type == H5O_TYPE_DATASET;
+}
+
+/// create the missing groups along the path, ending the path at each in turn
+void H5OutputFile::_create_parent_groups(H5PathView fullname)
+{
+    H5PathBuffer path(fullname);
+    H5PathTokenizer tokens(fullname);
+    H5PathView token;
+    size_t group_end = 0, name_end = 0;
+    while (tokens.next(token)) {
+        group_end = name_end;
+        name_end = tokens.end();
     }
-    //now reverse ids and load attribute
-    reverse(ids.begin(),ids.end());
-    //check if present
-    if (exists) {
-      H5Dclose(ids[0]);
-      ids.erase(ids.begin());
+    H5PathTokenizer groups(H5PathView(fullname.data(), group_end));
+    while (groups.next(token)) {
+        char c = path.data()[groups.end()];
+        path.data()[groups.end()] = '\0';
+        if (H5Lexists(file_id, path.c_str(), H5P_DEFAULT) <= 0) {
+            hid_t group_id = H5Gcreate(file_id, path.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+            if (group_id < 0) io_error(std::string("Failed to create group: ")+path.c_str());
+            H5Gclose(group_id);
+        }
+        path.data()[groups.end()] = c;
     }
-    close_hdf_ids(ids);
-    return exists;
 }
 
 /// create a dataset
-hid_t H5OutputFile::create_dataset(std::string fullname, hid_t type_id,
-  std::vector<hsize_t> dims, std::vector<hsize_t> chunkDims,
+hid_t H5OutputFile::create_dataset(H5PathView fullname, hid_t type_id,
+  H5Dims dims, H5Dims chunkDims,
   bool flag_closedataset,
   bool flag_parallel, bool flag_hyperslab, bool flag_collective)
 {
@@ -531,30 +656,22 @@ hid_t H5OutputFile::create_dataset(std::string fullname, hid_t type_id,
     MPI_Comm comm = mpi_comm_write;
     MPI_Info info = MPI_INFO_NULL;
 #endif
-    auto splitPath = _tokenize(fullname);
-    auto dsetname = splitPath.back();
-    splitPath.pop_back();
-    hid_t curr_id = file_id;
+    H5PathBuffer path(fullname);
     hid_t memspace_id, dspace_id, dset_id, prop_id = H5P_DEFAULT;
     auto rank = dims.size();
-    std::vector<hsize_t> chunks = chunkDims;
-    std::vector<hid_t> ids;
+    std::vector<hsize_t> chunks(chunkDims.begin(), chunkDims.end());
 
-    for (auto& groupname : splitPath)
-    {
-      if (H5Lexists(curr_id, groupname.c_str(), H5P_DEFAULT) == 0) curr_id = create_group(groupname);
-      else curr_id = open_group(groupname);
-      ids.push_back(curr_id);
-    }
+    _create_parent_groups(fullname);
 
 #ifdef USEPARALLELHDF
+    std::vector<hsize_t> dims_v(dims.vector());
     std::vector<unsigned long long> mpi_hdf_dims(rank*NProcsWrite), mpi_hdf_dims_tot(rank), dims_single(rank), dims_offset(rank);
-    _set_mpi_dim_and_offset(comm, rank, dims, dims_single, dims_offset, mpi_hdf_dims, mpi_hdf_dims_tot, flag_parallel, flag_first_dim_parallel);
+    _set_mpi_dim_and_offset(comm, rank, dims_v, dims_single, dims_offset, mpi_hdf_dims, mpi_hdf_dims_tot, flag_parallel, flag_first_dim_parallel);
 #endif
 
     // Determine if going to compress data in chunks
     // Only chunk non-zero size datasets
-    _set_chunks(chunks, dims,
+    _set_chunks(chunks, rank, dims.data(),
     #ifdef USEPARALLELHDF
         mpi_hdf_dims_tot,
     #endif
@@ -566,14 +683,14 @@ hid_t H5OutputFile::create_dataset(std::string fullname, hid_t type_id,
     dspace_id = H5Screate_simple(rank, dims.data(), NULL);
     memspace_id = dspace_id;
 #ifdef USEPARALLELHDF
-    _set_mpi_hyperslab(dspace_id, memspace_id, rank, dims, mpi_hdf_dims_tot, flag_parallel, flag_hyperslab);
+    _set_mpi_hyperslab(dspace_id, memspace_id, rank, dims_v, mpi_hdf_dims_tot, flag_parallel, flag_hyperslab);
 #endif
 
 #ifdef USEHDFCOMPRESSION
     prop_id = _set_compression(rank, chunks);
 #endif
 
-    dset_id = H5Dcreate(file_id, dsetname.c_str(), type_id, dspace_id,
+    dset_id = H5Dcreate(file_id, path.c_str(), type_id, dspace_id,
         H5P_DEFAULT, prop_id, H5P_DEFAULT);
     H5Pclose(prop_id);
 
@@ -581,41 +698,170 @@ hid_t H5OutputFile::create_dataset(std::string fullname, hid_t type_id,
     {
         H5Sclose(dspace_id);
         H5Dclose(dset_id);
-        reverse(ids.begin(),ids.end());
-        close_hdf_ids(ids);
     }
     return dset_id;
 }
 
+DatasetTemplate::DatasetTemplate()
+{
+    filetype_id = -1;
+    layout = H5D_CONTIGUOUS;
+    deflate_level = 0;
+    shuffle = false;
+    dcpl_id = dspace_id = memspace_id = -1;
+    xfer_id = H5P_DEFAULT;
+    iwrite = false;
+    flag_parallel = false;
+}
+
+DatasetTemplate::DatasetTemplate(DatasetTemplate &&tmpl)
+{
+    dcpl_id = dspace_id = memspace_id = -1;
+    xfer_id = H5P_DEFAULT;
+    *this = std::move(tmpl);
+}
+
+DatasetTemplate &DatasetTemplate::operator=(DatasetTemplate &&tmpl)
+{
+    if (this == &tmpl) return *this;
+    close();
+    filetype_id = tmpl.filetype_id;
+    dims = std::move(tmpl.dims);
+    chunks = std::move(tmpl.chunks);
+    layout = tmpl.layout;
+    deflate_level = tmpl.deflate_level;
+    shuffle = tmpl.shuffle;
+    dcpl_id = tmpl.dcpl_id;
+    dspace_id = tmpl.dspace_id;
+    memspace_id = tmpl.memspace_id;
+    xfer_id = tmpl.xfer_id;
+    iwrite = tmpl.iwrite;
+    flag_parallel = tmpl.flag_parallel;
+    row_counts = std::move(tmpl.row_counts);
+    // the moved from template no longer owns the ids
+    tmpl.dcpl_id = tmpl.dspace_id = tmpl.memspace_id = -1;
+    tmpl.xfer_id = H5P_DEFAULT;
+    return *this;
+}
+
+DatasetTemplate::~DatasetTemplate()
+{
+    close();
+}
+
+void DatasetTemplate::close()
+{
+    if (memspace_id >= 0 && memspace_id != dspace_id) H5Sclose(memspace_id);
+    if (dspace_id >= 0) H5Sclose(dspace_id);
+    if (dcpl_id >= 0) H5Pclose(dcpl_id);
+    if (xfer_id != H5P_DEFAULT) H5Pclose(xfer_id);
+    dcpl_id = dspace_id = memspace_id = -1;
+    xfer_id = H5P_DEFAULT;
+}
+
+/// build a dataset template
+DatasetTemplate H5OutputFile::create_dataset_template(hid_t filetype_id,
+    std::vector<hsize_t> dims, std::vector<hsize_t> chunkDims,
+    int deflate_level, bool shuffle, H5D_layout_t layout,
+    bool flag_parallel, bool flag_first_dim_parallel,
+    bool flag_hyperslab, bool flag_collective)
+{
+#ifdef USEPARALLELHDF
+    MPI_Comm comm = mpi_comm_write;
+#endif
+    DatasetTemplate tmpl;
+    int rank = dims.size();
+    if (rank == 0) io_error("Dataset template requires at least one dimension");
+    tmpl.filetype_id = filetype_id;
+    tmpl.dims = dims;
+    tmpl.chunks = chunkDims;
+    tmpl.deflate_level = deflate_level;
+    tmpl.shuffle = shuffle;
+    tmpl.flag_parallel = flag_parallel;
+
+#ifdef USEPARALLELHDF
+    std::vector<unsigned long long> mpi_hdf_dims(rank*NProcsWrite), mpi_hdf_dims_tot(rank), dims_single(rank), dims_offset(rank);
+    _set_mpi_dim_and_offset(comm, rank, dims, dims_single, dims_offset, mpi_hdf_dims, mpi_hdf_dims_tot, flag_parallel, flag_first_dim_parallel);
+    if (flag_parallel && flag_first_dim_parallel) {
+        tmpl.row_counts.resize(NProcsWrite);
+        for (auto t=0;t<NProcsWrite;t++) tmpl.row_counts[t] = mpi_hdf_dims[t*rank];
+    }
+#endif
+    _set_chunks(tmpl.chunks, rank, dims.data(),
+#ifdef USEPARALLELHDF
+        mpi_hdf_dims_tot,
+#endif
+        flag_parallel
+    );
+    if (layout == H5D_LAYOUT_ERROR) layout = tmpl.chunks.empty() ? H5D_CONTIGUOUS : H5D_CHUNKED;
+    if (layout == H5D_CHUNKED && tmpl.chunks.empty()) layout = H5D_CONTIGUOUS;
+    tmpl.layout = layout;
+
+    tmpl.dspace_id = H5Screate_simple(rank, dims.data(), NULL);
+    tmpl.memspace_id = tmpl.dspace_id;
+#ifdef USEPARALLELHDF
+    _set_mpi_hyperslab(tmpl.dspace_id, tmpl.memspace_id, rank, dims, mpi_hdf_dims_tot, flag_parallel, flag_hyperslab);
+#endif
+
+    tmpl.dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
+    if (tmpl.dcpl_id < 0) io_error("Failed to create dataset template property list");
+    H5Pset_layout(tmpl.dcpl_id, layout);
+    if (layout == H5D_CHUNKED) {
+        H5Pset_chunk(tmpl.dcpl_id, rank, tmpl.chunks.data());
+        if (shuffle) H5Pset_shuffle(tmpl.dcpl_id);
+        if (deflate_level > 0) H5Pset_deflate(tmpl.dcpl_id, deflate_level);
+    }
+
+    tmpl.xfer_id = H5P_DEFAULT;
+    tmpl.iwrite = (dims[0] > 0);
+#ifdef USEPARALLELHDF
+    _set_mpi_dataset_properties(tmpl.xfer_id, tmpl.iwrite,
+        tmpl.dspace_id, tmpl.memspace_id,
+        rank, dims, dims_offset,
+        flag_parallel, flag_collective, flag_hyperslab);
+#endif
+    return tmpl;
+}
+
+/// create a dataset from a template
+hid_t H5OutputFile::create_dataset(H5PathView fullname, const DatasetTemplate &tmpl,
+    bool flag_closedataset)
+{
+    hid_t dset_id = H5Dcreate(file_id, H5PathBuffer(fullname).c_str(), tmpl.filetype_id, tmpl.dspace_id,
+        H5P_DEFAULT, tmpl.dcpl_id, H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to create dataset: ")+fullname);
+    if (flag_closedataset) H5Dclose(dset_id);
+    return dset_id;
+}
+
 /// create a link
 herr_t H5OutputFile::create_link(std::string orgname, std::string linkname, bool ihard) {
-    std::vector<hid_t> orgids;
-    hid_t orgid = get_hdf5_id(orgname);
-    hid_t linkid;
-
-    if (H5Lexists(linkid, linkname.c_str(), H5P_DEFAULT))  {
+    // both names are paths from the root of the file
+    if (_exists_path(linkname))  {
         throw std::runtime_error("Link already exists, cannot create new link");
     }
     if (ihard) {
-        return H5Lcreate_hard(orgid, orgname.c_str(), linkid, linkname.c_str(), H5P_DEFAULT, H5P_DEFAULT);
+        return H5Lcreate_hard(file_id, orgname.c_str(), file_id, linkname.c_str(), H5P_DEFAULT, H5P_DEFAULT);
     }
     else {
-        return H5Lcreate_soft(orgname.c_str(), linkid, linkname.c_str(), H5P_DEFAULT, H5P_DEFAULT);
+        return H5Lcreate_soft(orgname.c_str(), file_id, linkname.c_str(), H5P_DEFAULT, H5P_DEFAULT);
     }
 }
 
 //write dataset with hyperslab selection
-void H5OutputFile::write_to_dataset_nd(std::string name, int rank, hsize_t *dims, void *data,
+void H5OutputFile::write_to_dataset_nd(H5PathView name, int rank, hsize_t *dims, void *data,
     const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
     hid_t memtype_id, hid_t filetype_id,
     bool flag_parallel, bool flag_first_dim_parallel,
     bool flag_hyperslab, bool flag_collective)
 {
+    if (_coalesce_write(name, rank, dims, data, count, start, memtype_id)) return;
+    _flush_coalesced(name);
     // Open the dataset
     hid_t dspace_id, memspace_id, prop_id, dset_id;
     herr_t ret;
     prop_id = H5P_DEFAULT;
-    dset_id = H5Dopen(file_id, name.c_str(), H5P_DEFAULT);
+    dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
     // create simple data space
     dspace_id = H5Screate_simple(rank, dims, NULL);
     memspace_id = dspace_id;
@@ -636,12 +882,20 @@ void H5OutputFile::write_to_dataset_nd(std::string name, int rank, hsize_t *dims
 #endif
     ret = H5Dwrite(dset_id, memtype_id, memspace_id, dspace_id, prop_id, data);
     if (ret < 0) io_error(std::string("Failed to write dataset: ")+name);
+    // statistics only of the selected elements, gathered into a contiguous buffer
+    if (write_statistics) {
+        hsize_t npoints = H5Sget_select_npoints(memspace_id);
+        size_t nbytes = npoints * H5Tget_size(memtype_id);
+        H5StagingBuffer selected = staging_pool.acquire(nbytes);
+        if (nbytes > 0) H5Dgather(memspace_id, data, memtype_id, nbytes, selected.data(), NULL, NULL);
+        _write_statistics(name, selected.data(), memtype_id, 1, &npoints, flag_parallel, true);
+    }
     if (memspace_id != dspace_id) H5Sclose(memspace_id);
     H5Sclose(dspace_id);
     H5Dclose(dset_id);
 }
 
-void H5OutputFile::write_dataset(std::string name, hsize_t len, std::string data,
+void H5OutputFile::write_dataset(H5PathView name, hsize_t len, std::string data,
     bool flag_parallel, bool flag_collective)
 {
 #ifdef USEPARALLELHDF
@@ -662,7 +916,7 @@ void H5OutputFile::write_dataset(std::string name, hsize_t len, std::string data
     dspace_id = H5Screate_simple(rank, dims, NULL);
 
     // Create the dataset
-    dset_id = H5Dcreate(file_id, name.c_str(), filetype_id, dspace_id,
+    dset_id = H5Dcreate(file_id, H5PathBuffer(name).c_str(), filetype_id, dspace_id,
         H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
 #ifdef USEPARALLELHDF
     if (flag_parallel) {
@@ -688,7 +942,7 @@ void H5OutputFile::write_dataset(std::string name, hsize_t len, std::string data
     H5Dclose(dset_id);
 }
 
-void H5OutputFile::write_dataset(std::string name, hsize_t len, void *data,
+void H5OutputFile::write_dataset(H5PathView name, hsize_t len, void *data,
     hid_t memtype_id, hid_t filetype_id,
     bool flag_parallel, bool flag_first_dim_parallel, bool flag_hyperslab, bool flag_collective)
 {
@@ -701,28 +955,99 @@ void H5OutputFile::write_dataset(std::string name, hsize_t len, void *data,
         flag_parallel, flag_first_dim_parallel, flag_hyperslab, flag_collective);
 }
 
-void H5OutputFile::write_dataset_nd(std::string name, int rank, hsize_t *dims, void *data,
+void H5OutputFile::write_dataset_nd(H5PathView name, int rank, hsize_t *dims, void *data,
     hid_t memtype_id, hid_t filetype_id,
     bool flag_parallel, bool flag_first_dim_parallel,
     bool flag_hyperslab, bool flag_collective)
 {
-#ifdef USEPARALLELHDF
-    MPI_Comm comm = mpi_comm_write;
-    MPI_Info info = MPI_INFO_NULL;
-#endif
     hid_t dspace_id, dset_id, prop_id, memspace_id, ret;
-    std::vector<hsize_t> chunks(rank);
-    prop_id = H5P_DEFAULT;
+    bool iwrite;
+    H5StagingBuffer ordered;
     // Get HDF5 data type of the array in memory
     if (memtype_id == -1) {
         throw std::runtime_error("Write data set called with void pointer but no type info passed.");
     }
     // Determine type of the dataset to create
     if(filetype_id < 0) filetype_id = memtype_id;
+    const void *buffer = data;
+    bool iordered = false;
+    // rows supplied by this task, before any redistribution
+    hsize_t nrows_local = dims[0];
+#ifdef PARALLELCOMPRESSIONACTIVE
+    // compressed chunks are written by a single task if the tasks hold whole chunks
+    std::vector<hsize_t> local_dims(dims, dims + rank);
+    H5StagingBuffer redistributed;
+    if (flag_parallel && flag_first_dim_parallel && flag_hyperslab) {
+        buffer = _apply_spatial_order(name, data, memtype_id, rank, dims, ordered);
+        iordered = true;
+        buffer = _redistribute_to_chunks(rank, local_dims, buffer, memtype_id, redistributed);
+        dims = local_dims.data();
+    }
+#endif
+#ifdef USEPARALLELHDF
+    // the extents are exchanged while the data is permuted and the dataset set up
+    H5MPIDimExchange exchange;
+    _post_mpi_dim_and_offset(mpi_comm_write, rank, dims, exchange, flag_parallel);
+#endif
+    if (!iordered) buffer = _apply_spatial_order(name, data, memtype_id, rank, dims, ordered);
+    _DedupKey dedup_key;
+    if (_dedup_lookup(name, buffer, memtype_id, filetype_id, rank, dims, flag_parallel, dedup_key)) {
+#ifdef USEPARALLELHDF
+        std::vector<unsigned long long> dims_offset;
+        _wait_mpi_dim_and_offset(rank, dims, exchange, dims_offset, flag_parallel, flag_first_dim_parallel);
+#endif
+        return;
+    }
 
+    _create_dataset_for_write(name, rank, dims, filetype_id,
+        dset_id, dspace_id, memspace_id, prop_id, iwrite,
+        flag_parallel, flag_first_dim_parallel,
+        flag_hyperslab, flag_collective
 #ifdef USEPARALLELHDF
-    std::vector<unsigned long long> mpi_hdf_dims(rank*NProcsWrite), mpi_hdf_dims_tot(rank), dims_single(rank), dims_offset(rank);
-    _set_mpi_dim_and_offset(comm, rank, dims, dims_single, dims_offset, mpi_hdf_dims, mpi_hdf_dims_tot, flag_parallel, flag_first_dim_parallel);
+        , &exchange
+#endif
+        );
+    if (iwrite) {
+        ret = H5Dwrite(dset_id, memtype_id, memspace_id, dspace_id, prop_id, buffer);
+        if (ret < 0) io_error(std::string("Failed to write dataset: ")+name);
+    }
+    _close_dataset_for_write(dset_id, dspace_id, memspace_id, prop_id,
+        flag_parallel, flag_hyperslab);
+    _record_decomposition(name, nrows_local, flag_parallel, flag_first_dim_parallel);
+    if (write_statistics) _write_statistics(name, buffer, memtype_id, rank, dims, flag_parallel, false);
+    _write_zone_map(name, buffer, memtype_id, rank, dims, flag_parallel);
+    _dedup_record(name, dedup_key);
+}
+
+/// create a dataset and the dataspaces and transfer properties needed to write to it
+void H5OutputFile::_create_dataset_for_write(H5PathView name, int rank, hsize_t *dims,
+    hid_t filetype_id,
+    hid_t &dset_id, hid_t &dspace_id, hid_t &memspace_id, hid_t &prop_id, bool &iwrite,
+    bool flag_parallel, bool flag_first_dim_parallel,
+    bool flag_hyperslab, bool flag_collective
+#ifdef USEPARALLELHDF
+    , H5MPIDimExchange *exchange
+#endif
+    )
+{
+#ifdef USEPARALLELHDF
+    MPI_Comm comm = mpi_comm_write;
+    MPI_Info info = MPI_INFO_NULL;
+#endif
+    std::vector<hsize_t> chunks;
+
+#ifdef USEPARALLELHDF
+    H5MPIDimExchange own_exchange;
+    if (exchange == NULL) {
+        exchange = &own_exchange;
+        _post_mpi_dim_and_offset(comm, rank, dims, *exchange, flag_parallel);
+    }
+    // set up the transfer properties while the extents are exchanged
+    hid_t xfer_id = H5P_DEFAULT;
+    if (flag_parallel) xfer_id = _create_mpi_transfer_properties(flag_collective);
+    std::vector<unsigned long long> dims_offset;
+    _wait_mpi_dim_and_offset(rank, dims, *exchange, dims_offset, flag_parallel, flag_first_dim_parallel);
+    std::vector<unsigned long long> &mpi_hdf_dims_tot = exchange->mpi_hdf_dims_tot;
 #endif
 
     // Determine if going to compress data in chunks
@@ -746,26 +1071,60 @@ void H5OutputFile::write_dataset_nd(std::string name, int rank, hsize_t *dims, v
 #ifdef USEHDFCOMPRESSION
     prop_id = _set_compression(rank, chunks);
 #endif
+    bool idelta = _use_delta_filter(name, filetype_id);
+#if defined(USEPARALLELHDF) && !defined(PARALLELCOMPRESSIONACTIVE)
+    // filtered datasets cannot be written in parallel without parallel compression
+    if (flag_parallel) idelta = false;
+#endif
+    if (idelta) {
+        // the filter needs chunks, by default runs of whole rows
+        if (chunks.empty()) {
+            chunks.assign(dims, dims + rank);
+#ifdef USEPARALLELHDF
+            if (flag_parallel) chunks.assign(mpi_hdf_dims_tot.begin(), mpi_hdf_dims_tot.end());
+#endif
+            chunks[0] = std::min<hsize_t>(chunks[0], HDFOUTPUTCHUNKSIZE);
+        }
+        if (std::find(chunks.begin(), chunks.end(), 0) == chunks.end()) {
+            bool ideflate = false;
+            if (prop_id == H5P_DEFAULT) {
+                prop_id = H5Pcreate(H5P_DATASET_CREATE);
+                H5Pset_chunk(prop_id, rank, chunks.data());
+            }
+            else {
+                // deflate goes after the delta filter to compress the packed differences
+                ideflate = (H5Pget_nfilters(prop_id) > 0);
+                if (ideflate) H5Premove_filter(prop_id, H5Z_FILTER_DEFLATE);
+            }
+            hdf5_set_delta_filter(prop_id);
+#ifdef USEHDFCOMPRESSION
+            if (ideflate) H5Pset_deflate(prop_id, HDFDEFLATE);
+#endif
+        }
+    }
 
     // Create the dataset
-    dset_id = H5Dcreate(file_id, name.c_str(), filetype_id, dspace_id,
+    dset_id = H5Dcreate(file_id, H5PathBuffer(name).c_str(), filetype_id, dspace_id,
         H5P_DEFAULT, prop_id, H5P_DEFAULT);
     if(dset_id < 0) io_error(std::string("Failed to create dataset: ")+name);
     H5Pclose(prop_id);
 
     prop_id = H5P_DEFAULT;
-    bool iwrite = (dims[0] > 0);
+    iwrite = (dims[0] > 0);
 #ifdef USEPARALLELHDF
+    prop_id = xfer_id;
     _set_mpi_dataset_properties(prop_id, iwrite,
         dspace_id, memspace_id,
         rank, dims, dims_offset,
         flag_parallel, flag_collective, flag_hyperslab);
 #endif
-    if (iwrite) {
-        ret = H5Dwrite(dset_id, memtype_id, memspace_id, dspace_id, prop_id, data);
-        if (ret < 0) io_error(std::string("Failed to write dataset: ")+name);
-    }
+}
 
+/// release the ids set by _create_dataset_for_write
+void H5OutputFile::_close_dataset_for_write(hid_t dset_id, hid_t dspace_id,
+    hid_t memspace_id, hid_t prop_id,
+    bool flag_parallel, bool flag_hyperslab)
+{
     // Clean up (note that dtype_id is NOT a new object so don't need to close it)
     H5Pclose(prop_id);
 #ifdef USEPARALLELHDF
@@ -775,8 +1134,122 @@ void H5OutputFile::write_dataset_nd(std::string name, int rank, hsize_t *dims, v
     H5Dclose(dset_id);
 }
 
+/// write several datasets, all created before a single write call
+void H5OutputFile::write_datasets(std::vector<H5DatasetWrite> &dsets,
+    bool flag_parallel, bool flag_first_dim_parallel,
+    bool flag_hyperslab, bool flag_collective)
+{
+    size_t ndsets = dsets.size();
+    std::vector<hid_t> dset_ids(ndsets), dspace_ids(ndsets), memspace_ids(ndsets), prop_ids(ndsets);
+    std::vector<hid_t> memtype_ids(ndsets);
+    std::vector<const void*> buffers(ndsets);
+    std::vector<bool> iwrite(ndsets);
+    std::vector<H5StagingBuffer> ordered(ndsets), redistributed(ndsets);
+    std::vector<std::vector<hsize_t>> local_dims(ndsets);
+    std::vector<_DedupKey> dedup_keys(ndsets);
+    std::vector<bool> ilinked(ndsets, false);
+#ifdef USEPARALLELHDF
+    std::vector<H5MPIDimExchange> exchanges(ndsets);
+#endif
+    herr_t ret;
+
+    for (auto i=0;i<ndsets;i++) {
+        if (dsets[i].memtype_id == -1) {
+            throw std::runtime_error("Write data sets called with void pointer but no type info passed.");
+        }
+        memtype_ids[i] = dsets[i].memtype_id;
+        local_dims[i] = dsets[i].dims;
+        buffers[i] = dsets[i].data;
+#ifdef PARALLELCOMPRESSIONACTIVE
+        if (flag_parallel && flag_first_dim_parallel && flag_hyperslab) {
+            buffers[i] = _apply_spatial_order(dsets[i].name, buffers[i], memtype_ids[i],
+                local_dims[i].size(), local_dims[i].data(), ordered[i]);
+            buffers[i] = _redistribute_to_chunks(local_dims[i].size(), local_dims[i],
+                buffers[i], memtype_ids[i], redistributed[i]);
+        }
+#endif
+#ifdef USEPARALLELHDF
+        // post the exchange of extents of every dataset before any waits
+        _post_mpi_dim_and_offset(mpi_comm_write, local_dims[i].size(), local_dims[i].data(),
+            exchanges[i], flag_parallel);
+#endif
+    }
+
+    for (auto i=0;i<ndsets;i++) {
+        hid_t filetype_id = dsets[i].filetype_id;
+        bool iwrite_single;
+        if (filetype_id < 0) filetype_id = dsets[i].memtype_id;
+        if (buffers[i] == dsets[i].data) {
+            buffers[i] = _apply_spatial_order(dsets[i].name, buffers[i], memtype_ids[i],
+                local_dims[i].size(), local_dims[i].data(), ordered[i]);
+        }
+        if (_dedup_lookup(dsets[i].name, buffers[i], memtype_ids[i], filetype_id,
+            local_dims[i].size(), local_dims[i].data(), flag_parallel, dedup_keys[i])) {
+#ifdef USEPARALLELHDF
+            std::vector<unsigned long long> dims_offset;
+            _wait_mpi_dim_and_offset(local_dims[i].size(), local_dims[i].data(), exchanges[i],
+                dims_offset, flag_parallel, flag_first_dim_parallel);
+#endif
+            ilinked[i] = true;
+            iwrite[i] = false;
+            continue;
+        }
+        _create_dataset_for_write(dsets[i].name, local_dims[i].size(), local_dims[i].data(),
+            filetype_id,
+            dset_ids[i], dspace_ids[i], memspace_ids[i], prop_ids[i], iwrite_single,
+            flag_parallel, flag_first_dim_parallel,
+            flag_hyperslab, flag_collective
+#ifdef USEPARALLELHDF
+            , &exchanges[i]
+#endif
+            );
+        iwrite[i] = iwrite_single;
+    }
+
+#if H5_VERSION_GE(1,14,0)
+    // one transfer property list is used for all datasets, they are all
+    // created with the same flags so the properties are identical.
+    // datasets with nothing to write on any task are left out
+    std::vector<hid_t> w_dset_ids, w_dspace_ids, w_memspace_ids, w_memtype_ids;
+    std::vector<const void*> w_buffers;
+    hid_t w_prop_id = H5P_DEFAULT;
+    for (auto i=0;i<ndsets;i++) {
+        if (!iwrite[i]) continue;
+        if (w_dset_ids.size() == 0) w_prop_id = prop_ids[i];
+        w_dset_ids.push_back(dset_ids[i]);
+        w_memtype_ids.push_back(memtype_ids[i]);
+        w_memspace_ids.push_back(memspace_ids[i]);
+        w_dspace_ids.push_back(dspace_ids[i]);
+        w_buffers.push_back(buffers[i]);
+    }
+    if (w_dset_ids.size() > 0) {
+        ret = H5Dwrite_multi(w_dset_ids.size(), w_dset_ids.data(), w_memtype_ids.data(),
+            w_memspace_ids.data(), w_dspace_ids.data(), w_prop_id, w_buffers.data());
+        if (ret < 0) io_error(std::string("Failed to write multiple datasets starting with: ")+dsets[0].name);
+    }
+#else
+    for (auto i=0;i<ndsets;i++) {
+        if (!iwrite[i]) continue;
+        ret = H5Dwrite(dset_ids[i], memtype_ids[i], memspace_ids[i], dspace_ids[i], prop_ids[i], buffers[i]);
+        if (ret < 0) io_error(std::string("Failed to write dataset: ")+dsets[i].name);
+    }
+#endif
+
+    for (auto i=0;i<ndsets;i++) {
+        if (ilinked[i]) continue;
+        _close_dataset_for_write(dset_ids[i], dspace_ids[i], memspace_ids[i], prop_ids[i],
+            flag_parallel, flag_hyperslab);
+        _record_decomposition(dsets[i].name, dsets[i].dims[0], flag_parallel, flag_first_dim_parallel);
+        if (write_statistics) _write_statistics(dsets[i].name, buffers[i], dsets[i].memtype_id,
+            local_dims[i].size(), local_dims[i].data(), flag_parallel, false);
+        _write_zone_map(dsets[i].name, buffers[i], dsets[i].memtype_id,
+            local_dims[i].size(), local_dims[i].data(), flag_parallel);
+        _dedup_record(dsets[i].name, dedup_keys[i]);
+    }
+}
+
 /// Write data set with hyperslab set by count and start
-void H5OutputFile::write_dataset(std::string name, hsize_t len, void *data,
+void H5OutputFile::write_dataset(H5PathView name, hsize_t len, void *data,
     const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
     hid_t memtype_id, hid_t filetype_id,
     bool flag_parallel, bool flag_first_dim_parallel, bool flag_hyperslab, bool flag_collective)
@@ -793,7 +1266,7 @@ void H5OutputFile::write_dataset(std::string name, hsize_t len, void *data,
 }
 
 ///\todo need to update this to general mpi hyper slab selection
-void H5OutputFile::write_dataset_nd(std::string name, int rank, hsize_t *dims, void *data,
+void H5OutputFile::write_dataset_nd(H5PathView name, int rank, hsize_t *dims, void *data,
     const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
     hid_t memtype_id, hid_t filetype_id,
     bool flag_parallel, bool flag_first_dim_parallel,
@@ -804,7 +1277,7 @@ void H5OutputFile::write_dataset_nd(std::string name, int rank, hsize_t *dims, v
     MPI_Info info = MPI_INFO_NULL;
 #endif
     hid_t dspace_id, dset_id, prop_id, memspace_id, ret;
-    std::vector<hsize_t> chunks(rank);
+    std::vector<hsize_t> chunks;
     // Get HDF5 data type of the array in memory
     if (memtype_id == -1) {
         throw std::runtime_error("Write data set called with void pointer but no type info passed.");
@@ -839,7 +1312,7 @@ void H5OutputFile::write_dataset_nd(std::string name, int rank, hsize_t *dims, v
     prop_id = _set_compression(rank, chunks);
 #endif
     // Create the dataset
-    dset_id = H5Dcreate(file_id, name.c_str(), filetype_id, dspace_id,
+    dset_id = H5Dcreate(file_id, H5PathBuffer(name).c_str(), filetype_id, dspace_id,
         H5P_DEFAULT, prop_id, H5P_DEFAULT);
     if(dset_id < 0) io_error(std::string("Failed to create dataset: ")+name);
     H5Pclose(prop_id);
@@ -870,3 +1343,90 @@ void H5OutputFile::write_dataset_nd(std::string name, int rank, hsize_t *dims, v
     H5Sclose(dspace_id);
     H5Dclose(dset_id);
 }
+
+/// read from data set with hyperslab set by count and start
+void H5OutputFile::read_from_dataset_nd(H5PathView name, void *data,
+    const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
+    hid_t memtype_id)
+{
+    _flush_coalesced(name);
+    hid_t dset_id, dspace_id, memspace_id;
+    herr_t ret;
+    dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset: ")+name);
+    dspace_id = H5Dget_space(dset_id);
+    memspace_id = H5S_ALL;
+    if (!count.empty() && !start.empty()) {
+        ret = H5Sselect_hyperslab(dspace_id, H5S_SELECT_SET, start.data(), NULL, count.data(), NULL);
+        if (ret < 0) io_error(std::string("Failed to select hyperslab for reading from dataset: ")+name);
+        memspace_id = H5Screate_simple(count.size(), count.data(), NULL);
+    }
+    ret = H5Dread(dset_id, memtype_id, memspace_id, dspace_id, H5P_DEFAULT, data);
+    if (ret < 0) io_error(std::string("Failed to read dataset: ")+name);
+    if (memspace_id != H5S_ALL) H5Sclose(memspace_id);
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+}
+
+/// create ragged array group and write the prefix-sum offsets
+hsize_t H5OutputFile::_write_ragged_offsets(H5PathView name,
+    hsize_t nelem, const unsigned long long *counts,
+    bool flag_parallel, bool flag_collective)
+{
+    unsigned long long nvalues = 0, value_offset = 0;
+    std::vector<unsigned long long> offsets;
+    hsize_t dims[1];
+    bool ilast = true;
+
+    for (hsize_t i=0;i<nelem;i++) nvalues += counts[i];
+#ifdef USEPARALLELHDF
+    // offsets are global so shift by the values on lower tasks
+    // and only the last task writes the closing offset
+    if (flag_parallel) {
+        MPI_Comm comm = mpi_comm_write;
+        MPI_Exscan(&nvalues, &value_offset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+        if (ThisWriteTask == 0) value_offset = 0;
+        ilast = (ThisWriteTask == NProcsWrite-1);
+    }
+#endif
+    offsets.resize(nelem + ilast);
+    for (hsize_t i=0;i<nelem;i++) {
+        offsets[i] = value_offset;
+        value_offset += counts[i];
+    }
+    if (ilast) offsets[nelem] = value_offset;
+
+    hid_t group_id = H5Gcreate(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if (group_id < 0) io_error(std::string("Failed to create ragged dataset group: ")+name);
+    H5Gclose(group_id);
+
+    dims[0] = offsets.size();
+    write_dataset_nd(name+"/offsets", 1, dims, offsets.data(),
+        H5T_NATIVE_ULLONG, -1,
+        flag_parallel, true, true, flag_collective);
+    return nvalues;
+}
+
+/// write a dataset using a template, only creating the dataset
+void H5OutputFile::write_dataset_nd(H5PathView name, const DatasetTemplate &tmpl, void *data,
+    hid_t memtype_id)
+{
+    herr_t ret;
+    H5StagingBuffer ordered;
+    const void *buffer = _apply_spatial_order(name, data, memtype_id,
+        tmpl.dims.size(), tmpl.dims.data(), ordered);
+    _DedupKey dedup_key;
+    if (_dedup_lookup(name, buffer, memtype_id, tmpl.filetype_id,
+        tmpl.dims.size(), tmpl.dims.data(), tmpl.flag_parallel, dedup_key)) return;
+    hid_t dset_id = create_dataset(name, tmpl, false);
+    if (tmpl.iwrite) {
+        ret = H5Dwrite(dset_id, memtype_id, tmpl.memspace_id, tmpl.dspace_id, tmpl.xfer_id, buffer);
+        if (ret < 0) io_error(std::string("Failed to write dataset: ")+name);
+    }
+    H5Dclose(dset_id);
+    if (write_decomposition && !tmpl.row_counts.empty()) _write_decomposition(name, tmpl.row_counts);
+    if (write_statistics) _write_statistics(name, buffer, memtype_id,
+        tmpl.dims.size(), tmpl.dims.data(), tmpl.flag_parallel, false);
+    _write_zone_map(name, buffer, memtype_id, tmpl.dims.size(), tmpl.dims.data(), tmpl.flag_parallel);
+    _dedup_record(name, dedup_key);
+}
@@ -2,13 +2,22 @@
 #define _HDF5WRAPPER_H
 
 #include <vector>
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <chrono>
 #include <sstream>
 #include <iterator>
 #include <cstring>
+#include <cstdint>
 #include <string>
+#include <list>
+#include <initializer_list>
+#include <sys/types.h>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <stdexcept>
 #include <hdf5.h>
 
 #ifdef USEMPI
@@ -27,9 +36,65 @@ static inline hid_t hdf5_type(unsigned int dummy)       {return H5T_NATIVE_UINT;
 static inline hid_t hdf5_type(unsigned long dummy)      {return H5T_NATIVE_ULONG;}
 static inline hid_t hdf5_type(unsigned long long dummy) {return H5T_NATIVE_ULLONG;}
 static inline hid_t hdf5_type(std::string dummy)        {return H5T_C_S1;}
+
+/// Reduced precision floating point types used for storage on disk only.
+/// Both are 16 bit types in native byte order, IEEE half (1,5,10) and bfloat16 (1,8,7).
+/// The first call builds the types and registers hard conversion functions
+/// to and from the native float so that H5Dwrite/H5Dread use the wrapper's
+/// vectorized kernels rather than the generic soft float conversion.
+hid_t hdf5_type_float16();
+hid_t hdf5_type_bfloat16();
+/// register the reduced precision types and their conversion paths
+void hdf5_register_reduced_precision_types();
+/// conversion kernels, exposed so they can be used outside of HDF5 calls
+void hdf5_convert_float_to_float16(const float *in, uint16_t *out, size_t n);
+void hdf5_convert_float16_to_float(const uint16_t *in, float *out, size_t n);
+void hdf5_convert_float_to_bfloat16(const float *in, uint16_t *out, size_t n);
+void hdf5_convert_bfloat16_to_float(const uint16_t *in, float *out, size_t n);
+
+/// Identifier of the wrapper's delta filter for 32 and 64 bit integer datasets.
+/// It is not registered with The HDF Group, so it sits in the range 256-511
+/// that HDF5 sets aside for testing filters, and could clash with another
+/// unregistered filter using the same id. Chunks are stored as zigzag
+/// encoded differences of consecutive values bit-packed in blocks, which suits
+/// sorted IDs, offsets and indices. The filter is optional so chunks that do
+/// not shrink are stored unfiltered, and it is registered by H5OutputFile so
+/// datasets using it are decoded transparently on read through the wrapper.
+/// Other readers, such as h5dump, h5py or a program using HDF5 directly,
+/// cannot read the filtered chunks of these datasets unless they link the
+/// wrapper and call hdf5_register_delta_filter.
+const H5Z_filter_t H5Z_FILTER_HDF5WRAPPER_DELTA = 305;
+/// register the delta filter with HDF5 if not already registered
+void hdf5_register_delta_filter();
+/// add the delta filter to a chunked dataset creation property list
+herr_t hdf5_set_delta_filter(hid_t dcpl_id);
+
+/// Call visitor(T{}) with the C type T matching a native numeric HDF5 type,
+/// returns false if the type is not one of the native numeric types
+template<typename Visitor> bool hdf5_visit_native_type(hid_t type_id, Visitor &visitor)
+{
+    if (H5Tequal(type_id, H5T_NATIVE_FLOAT) > 0) visitor((float)0);
+    else if (H5Tequal(type_id, H5T_NATIVE_DOUBLE) > 0) visitor((double)0);
+    else if (H5Tequal(type_id, H5T_NATIVE_SHORT) > 0) visitor((short)0);
+    else if (H5Tequal(type_id, H5T_NATIVE_INT) > 0) visitor((int)0);
+    else if (H5Tequal(type_id, H5T_NATIVE_LONG) > 0) visitor((long)0);
+    else if (H5Tequal(type_id, H5T_NATIVE_LLONG) > 0) visitor((long long)0);
+    else if (H5Tequal(type_id, H5T_NATIVE_USHORT) > 0) visitor((unsigned short)0);
+    else if (H5Tequal(type_id, H5T_NATIVE_UINT) > 0) visitor((unsigned int)0);
+    else if (H5Tequal(type_id, H5T_NATIVE_ULONG) > 0) visitor((unsigned long)0);
+    else if (H5Tequal(type_id, H5T_NATIVE_ULLONG) > 0) visitor((unsigned long long)0);
+    else return false;
+    return true;
+}
+
+/// fast non-cryptographic 64 bit hash (xxHash64) of a buffer
+uint64_t hdf5_hash64(const void *data, size_t len, uint64_t seed = 0);
+
 static inline hid_t hdf5_type_from_string(std::string dummy)
 {
-    if (dummy == std::string("float32")) return H5T_NATIVE_FLOAT;
+    if (dummy == std::string("float16")) return hdf5_type_float16();
+    else if (dummy == std::string("bfloat16")) return hdf5_type_bfloat16();
+    else if (dummy == std::string("float32")) return H5T_NATIVE_FLOAT;
     else if (dummy == std::string("float64")) return H5T_NATIVE_DOUBLE;
     else if (dummy == std::string("int16")) return H5T_NATIVE_SHORT;
     else if (dummy == std::string("int32")) return H5T_NATIVE_INT;
@@ -46,11 +111,480 @@ static inline hid_t hdf5_type_from_string(std::string dummy)
 #if H5_VERSION_GE(1,12,0)
 #endif
 
+/// summary statistics of a dataset computed as it is written, stored
+/// as stats_* attributes of the dataset
+struct H5DatasetStatistics
+{
+    double min, max, sum;
+    unsigned long long count, nan_count;
+    /// fixed-bin histogram over [histogram_min, histogram_max], values
+    /// outside the range are counted in the end bins
+    std::vector<unsigned long long> histogram;
+    double histogram_min, histogram_max;
+};
+
+/// Non-owning view of a path, a pointer and length, so that names can be
+/// passed as literals, std::string or parts of a larger buffer without copies
+struct H5PathView
+{
+    const char *ptr;
+    size_t len;
+
+    H5PathView() : ptr(""), len(0) {}
+    H5PathView(const char *s) : ptr(s), len(std::strlen(s)) {}
+    H5PathView(const char *s, size_t n) : ptr(s), len(n) {}
+    H5PathView(const std::string &s) : ptr(s.data()), len(s.size()) {}
+    const char *data() const {return ptr;}
+    size_t size() const {return len;}
+    bool empty() const {return len == 0;}
+    char operator[](size_t i) const {return ptr[i];}
+    std::string str() const {return std::string(ptr, len);}
+};
+
+/// paths built from views, for error messages and names of companion datasets
+inline std::string operator+(const std::string &a, H5PathView b)
+{
+    return a + b.str();
+}
+inline std::string operator+(H5PathView a, const std::string &b)
+{
+    return a.str() + b;
+}
+inline bool operator==(H5PathView a, H5PathView b)
+{
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+/// Split a path into its components separated by '/' without allocating,
+/// empty components (leading, trailing or repeated '/') are skipped
+class H5PathTokenizer
+{
+public:
+    H5PathTokenizer(H5PathView _path) : path(_path), pos(0) {}
+    /// set token to the next component, returning false once there are none
+    bool next(H5PathView &token)
+    {
+        while (pos < path.size() && path[pos] == '/') pos++;
+        if (pos == path.size()) return false;
+        size_t start = pos;
+        while (pos < path.size() && path[pos] != '/') pos++;
+        token = H5PathView(path.data() + start, pos - start);
+        return true;
+    }
+    /// offset of the end of the last component returned
+    size_t end() const {return pos;}
+private:
+    H5PathView path;
+    size_t pos;
+};
+
+/// maximum length of a path held on the stack by H5PathBuffer
+#define H5PATHBUFFERSIZE 256
+
+/// Null terminated copy of a path, or of a path joined with a name, as needed
+/// by the HDF5 calls. Paths that fit are held on the stack, longer ones on the heap.
+class H5PathBuffer
+{
+public:
+    H5PathBuffer(H5PathView path) {_assign(path, H5PathView());}
+    H5PathBuffer(H5PathView path, H5PathView name) {_assign(path, name);}
+    char *data() {return buf;}
+    const char *c_str() const {return buf;}
+    size_t size() const {return len;}
+private:
+    void _assign(H5PathView path, H5PathView name)
+    {
+        len = path.size() + (name.empty() ? 0 : name.size() + 1);
+        buf = local;
+        if (len >= H5PATHBUFFERSIZE) {
+            heap.resize(len + 1);
+            buf = &heap[0];
+        }
+        std::memcpy(buf, path.data(), path.size());
+        if (!name.empty()) {
+            buf[path.size()] = '/';
+            std::memcpy(buf + path.size() + 1, name.data(), name.size());
+        }
+        buf[len] = '\0';
+    }
+    H5PathBuffer(const H5PathBuffer &);
+    H5PathBuffer &operator=(const H5PathBuffer &);
+    char local[H5PATHBUFFERSIZE];
+    std::string heap;
+    char *buf;
+    size_t len;
+};
+
+/// Dimensions of a dataspace held in place, up to the maximum rank of HDF5,
+/// so that passing shapes around does not allocate
+class H5Dims
+{
+public:
+    H5Dims() : n(0) {}
+    H5Dims(std::initializer_list<hsize_t> dims) {_assign(dims.size(), dims.begin());}
+    H5Dims(const std::vector<hsize_t> &dims) {_assign(dims.size(), dims.data());}
+    H5Dims(size_t rank, const hsize_t *dims) {_assign(rank, dims);}
+    hsize_t *data() {return vals;}
+    const hsize_t *data() const {return vals;}
+    size_t size() const {return n;}
+    bool empty() const {return n == 0;}
+    hsize_t &operator[](size_t i) {return vals[i];}
+    hsize_t operator[](size_t i) const {return vals[i];}
+    hsize_t *begin() {return vals;}
+    hsize_t *end() {return vals + n;}
+    const hsize_t *begin() const {return vals;}
+    const hsize_t *end() const {return vals + n;}
+    std::vector<hsize_t> vector() const {return std::vector<hsize_t>(vals, vals + n);}
+private:
+    void _assign(size_t rank, const hsize_t *dims)
+    {
+        if (rank > H5S_MAX_RANK) throw std::invalid_argument("Rank of dimensions beyond the maximum rank of HDF5");
+        n = rank;
+        for (size_t i=0;i<rank;i++) vals[i] = dims[i];
+    }
+    hsize_t vals[H5S_MAX_RANK];
+    size_t n;
+};
+
+/// description of one dataset to be written with H5OutputFile::write_datasets
+struct H5DatasetWrite
+{
+    std::string name;
+    std::vector<hsize_t> dims;
+    const void *data;
+    hid_t memtype_id;
+    hid_t filetype_id;
+
+    H5DatasetWrite(std::string _name, std::vector<hsize_t> _dims, const void *_data,
+        hid_t _memtype_id, hid_t _filetype_id = -1) :
+        name(_name), dims(_dims), data(_data),
+        memtype_id(_memtype_id), filetype_id(_filetype_id) {}
+    template <typename T> H5DatasetWrite(std::string _name, std::vector<hsize_t> _dims,
+        const T *_data, hid_t _filetype_id = -1) :
+        name(_name), dims(_dims), data(_data),
+        memtype_id(hdf5_type(T{})), filetype_id(_filetype_id) {}
+};
+
+/// Producer of the slabs of a streamed dataset, filling buf with the nrows
+/// rows starting at row_start. When double buffered it is called from a
+/// different thread than the one writing and must not call HDF5.
+typedef std::function<void(hsize_t row_start, hsize_t nrows, void *buf)> H5SlabProducer;
+
+/// Reusable description of a dataset: file type, dimensions, chunking,
+/// filters and layout. Built once by H5OutputFile::create_dataset_template,
+/// it holds the creation property list, data spaces (with any parallel
+/// hyperslab selection already made) and transfer properties so that
+/// repeated creation of datasets of the same shape skips all of that setup.
+/// Ids are released when the template is destroyed.
+class DatasetTemplate
+{
+public:
+    hid_t filetype_id;
+    /// dimensions of the data local to this task
+    std::vector<hsize_t> dims;
+    /// chunk dimensions, empty if not chunked
+    std::vector<hsize_t> chunks;
+    H5D_layout_t layout;
+    /// deflate level, 0 for no compression
+    int deflate_level;
+    bool shuffle;
+
+    hid_t dcpl_id, dspace_id, memspace_id, xfer_id;
+    /// whether there is any data to write
+    bool iwrite;
+    /// whether the template was built for a parallel write
+    bool flag_parallel;
+    /// rows of every task for a parallel write split along the first
+    /// dimension, recorded as the decomposition if requested
+    std::vector<unsigned long long> row_counts;
+
+    DatasetTemplate();
+    DatasetTemplate(DatasetTemplate &&tmpl);
+    DatasetTemplate &operator=(DatasetTemplate &&tmpl);
+    DatasetTemplate(const DatasetTemplate &) = delete;
+    DatasetTemplate &operator=(const DatasetTemplate &) = delete;
+    ~DatasetTemplate();
+
+    /// release hdf5 ids
+    void close();
+};
+
+/// Memory held by the staging buffers of an H5OutputFile
+struct H5StagingStatistics
+{
+    /// bytes allocated, bytes lent out to writes and the most ever allocated
+    size_t bytes_held, bytes_in_use, peak_bytes_held;
+    size_t nbuffers;
+    /// buffer requests, those served by an existing buffer and new allocations
+    unsigned long long nrequests, nreuses, nallocations;
+};
+
+class H5StagingPool;
+
+/// Staging buffer lent by an H5StagingPool, returned to the pool when destroyed
+class H5StagingBuffer
+{
+public:
+    H5StagingBuffer() : pool(NULL), ptr(NULL), nbytes(0) {}
+    H5StagingBuffer(H5StagingPool *pool, void *ptr, size_t nbytes) : pool(pool), ptr(ptr), nbytes(nbytes) {}
+    H5StagingBuffer(H5StagingBuffer &&buf) : pool(buf.pool), ptr(buf.ptr), nbytes(buf.nbytes)
+    {
+        buf.pool = NULL;
+        buf.ptr = NULL;
+        buf.nbytes = 0;
+    }
+    H5StagingBuffer &operator=(H5StagingBuffer &&buf)
+    {
+        if (this != &buf) {
+            release();
+            std::swap(pool, buf.pool);
+            std::swap(ptr, buf.ptr);
+            std::swap(nbytes, buf.nbytes);
+        }
+        return *this;
+    }
+    H5StagingBuffer(const H5StagingBuffer &) = delete;
+    H5StagingBuffer &operator=(const H5StagingBuffer &) = delete;
+    ~H5StagingBuffer() {release();}
+
+    void *data() const {return ptr;}
+    size_t size() const {return nbytes;}
+    /// give the buffer back to the pool
+    void release();
+
+private:
+    H5StagingPool *pool;
+    void *ptr;
+    size_t nbytes;
+};
+
+/// Pool of aligned staging buffers for permutation, conversion, compression
+/// and aggregation steps of the writes. Buffers are kept after use so that
+/// repeated writes reuse them rather than allocating and faulting in fresh
+/// pages, up to a high-water mark on the memory kept. Large buffers are
+/// aligned to huge pages and marked for transparent huge pages where supported.
+class H5StagingPool
+{
+public:
+    H5StagingPool();
+    /// copies start empty, buffers are never shared
+    H5StagingPool(const H5StagingPool &pool);
+    H5StagingPool &operator=(const H5StagingPool &pool);
+    ~H5StagingPool();
+
+    /// lend a buffer of at least nbytes
+    H5StagingBuffer acquire(size_t nbytes);
+    /// memory kept by idle buffers is limited so the total held is at most nbytes
+    void set_high_water_mark(size_t nbytes);
+    /// free all idle buffers
+    void trim();
+    H5StagingStatistics statistics() const {return stats;}
+
+private:
+    friend class H5StagingBuffer;
+    struct Buffer
+    {
+        void *ptr;
+        size_t nbytes;
+        bool inuse;
+    };
+    std::vector<Buffer> buffers;
+    size_t high_water_mark;
+    H5StagingStatistics stats;
+
+    void _release(void *ptr);
+    /// free idle buffers, largest first, until at most nbytes are held
+    void _free_idle(size_t nbytes);
+};
+
+/// Read-only view of a dataset indexed like an array without loading it.
+/// Elements are read a block at a time on demand, the block being the chunk
+/// if the dataset is chunked, and the most recently used blocks are kept in
+/// an LRU cache so scans and localised random access read each block once.
+/// Built by H5OutputFile::open_dataset_view.
+template<typename T> class DatasetView
+{
+public:
+    /// input iterator over the elements in row-major order
+    class iterator
+    {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T *pointer;
+        typedef T reference;
+        iterator(DatasetView *view, hsize_t index) : view(view), index(index) {}
+        T operator*() const {return (*view)[index];}
+        iterator &operator++() {index++; return *this;}
+        iterator operator++(int) {iterator it = *this; index++; return it;}
+        bool operator==(const iterator &it) const {return index == it.index;}
+        bool operator!=(const iterator &it) const {return index != it.index;}
+    private:
+        DatasetView *view;
+        hsize_t index;
+    };
+
+    /// takes ownership of an open dataset, caching at most max_blocks blocks
+    DatasetView(hid_t dset_id, const std::vector<hsize_t> &block_dims, size_t max_blocks)
+        : dset_id(dset_id), block_dims(block_dims), max_blocks(std::max<size_t>(max_blocks, 1)),
+        nhits(0), nmisses(0)
+    {
+        dspace_id = H5Dget_space(dset_id);
+        int rank = H5Sget_simple_extent_ndims(dspace_id);
+        dims.resize(rank);
+        H5Sget_simple_extent_dims(dspace_id, dims.data(), NULL);
+        nblocks.resize(rank);
+        coord.resize(rank);
+        nelements = 1;
+        for (auto i=0;i<rank;i++) {
+            nblocks[i] = (dims[i] + block_dims[i] - 1) / block_dims[i];
+            nelements *= dims[i];
+        }
+    }
+    DatasetView(DatasetView &&view)
+        : dset_id(view.dset_id), dspace_id(view.dspace_id),
+        dims(std::move(view.dims)), block_dims(std::move(view.block_dims)),
+        nblocks(std::move(view.nblocks)), coord(std::move(view.coord)),
+        nelements(view.nelements), max_blocks(view.max_blocks),
+        blocks(std::move(view.blocks)), block_map(std::move(view.block_map)),
+        nhits(view.nhits), nmisses(view.nmisses)
+    {
+        view.dset_id = view.dspace_id = -1;
+    }
+    DatasetView(const DatasetView &) = delete;
+    DatasetView &operator=(const DatasetView &) = delete;
+    ~DatasetView()
+    {
+        if (dspace_id >= 0) H5Sclose(dspace_id);
+        if (dset_id >= 0) H5Dclose(dset_id);
+    }
+
+    /// number of elements
+    hsize_t size() const {return nelements;}
+    const std::vector<hsize_t> &shape() const {return dims;}
+    /// cache statistics
+    unsigned long long cache_hits() const {return nhits;}
+    unsigned long long cache_misses() const {return nmisses;}
+
+    /// element at a row-major flattened index, not bounds checked
+    T operator[](hsize_t index)
+    {
+        for (auto i=(int)dims.size()-1;i>=0;i--) {
+            coord[i] = index % dims[i];
+            index /= dims[i];
+        }
+        return _get(coord.data());
+    }
+    /// element at a coordinate, bounds checked
+    template<typename... Idx> T at(Idx... idx)
+    {
+        hsize_t c[] = {(hsize_t)idx...};
+        if (sizeof...(idx) != dims.size())
+            throw std::out_of_range("DatasetView::at called with wrong number of indices");
+        for (auto i=0;i<dims.size();i++) {
+            if (c[i] >= dims[i]) throw std::out_of_range("DatasetView::at index out of range");
+        }
+        return _get(c);
+    }
+
+    iterator begin() {return iterator(this, 0);}
+    iterator end() {return iterator(this, nelements);}
+
+private:
+    struct Block
+    {
+        hsize_t key;
+        std::vector<hsize_t> start, count;
+        std::vector<T> data;
+    };
+
+    hid_t dset_id, dspace_id;
+    std::vector<hsize_t> dims, block_dims, nblocks, coord;
+    hsize_t nelements;
+    size_t max_blocks;
+    /// cached blocks, most recently used first
+    std::list<Block> blocks;
+    std::unordered_map<hsize_t, typename std::list<Block>::iterator> block_map;
+    unsigned long long nhits, nmisses;
+
+    T _get(const hsize_t *c)
+    {
+        hsize_t key = 0, offset = 0;
+        for (auto i=0;i<dims.size();i++) key = key * nblocks[i] + c[i] / block_dims[i];
+        if (blocks.size() > 0 && blocks.front().key == key) {
+            nhits++;
+        }
+        else {
+            auto it = block_map.find(key);
+            if (it != block_map.end()) {
+                nhits++;
+                blocks.splice(blocks.begin(), blocks, it->second);
+            }
+            else {
+                nmisses++;
+                _load_block(key, c);
+            }
+        }
+        const Block &block = blocks.front();
+        for (auto i=0;i<dims.size();i++) offset = offset * block.count[i] + c[i] - block.start[i];
+        return block.data[offset];
+    }
+
+    /// read the block holding a coordinate to the front of the cache,
+    /// reusing the storage of the least recently used block when full
+    void _load_block(hsize_t key, const hsize_t *c)
+    {
+        if (blocks.size() >= max_blocks) {
+            block_map.erase(blocks.back().key);
+            blocks.splice(blocks.begin(), blocks, std::prev(blocks.end()));
+        }
+        else {
+            blocks.emplace_front();
+        }
+        Block &block = blocks.front();
+        block.key = key;
+        block.start.resize(dims.size());
+        block.count.resize(dims.size());
+        hsize_t n = 1;
+        for (auto i=0;i<dims.size();i++) {
+            block.start[i] = (c[i] / block_dims[i]) * block_dims[i];
+            block.count[i] = std::min(block_dims[i], dims[i] - block.start[i]);
+            n *= block.count[i];
+        }
+        block.data.resize(n);
+        hid_t memspace_id = H5Screate_simple(1, &n, NULL);
+        if (dims.size() > 0) {
+            H5Sselect_hyperslab(dspace_id, H5S_SELECT_SET, block.start.data(), NULL, block.count.data(), NULL);
+        }
+        herr_t ret = H5Dread(dset_id, hdf5_type(T{}), memspace_id, dspace_id, H5P_DEFAULT, block.data.data());
+        H5Sclose(memspace_id);
+        if (ret < 0) {
+            blocks.pop_front();
+            throw std::runtime_error("DatasetView failed to read block of dataset");
+        }
+        block_map[key] = blocks.begin();
+    }
+};
+
+#ifdef USEPARALLELHDF
+/// Exchange of the local extents of a dataset between the writing tasks,
+/// posted with non-blocking collectives so that other setup can proceed
+/// while it is in flight
+struct H5MPIDimExchange
+{
+    std::vector<unsigned long long> dims_single, mpi_hdf_dims, mpi_hdf_dims_tot;
+    MPI_Request requests[2];
+    bool iposted = false;
+};
+#endif
+
 ///\name HDF class to manage writing information
 ///\todo need to look into whether one can open directly with
 /// full path or must open groups explicitly. If latter, updated needed
 class H5OutputFile
 {
+    friend class H5WriterPool;
 
 private:
 
@@ -59,6 +593,62 @@ private:
     hid_t parallel_access_id;
 #endif
 
+    /// whether statistics are computed when writing datasets and the histogram settings
+    bool write_statistics;
+    unsigned int statistics_nbins;
+    double statistics_histogram_min, statistics_histogram_max;
+
+    /// datasets for which a per-chunk min/max index is written
+    std::vector<std::string> zone_map_datasets;
+    /// integer datasets stored with the delta filter
+    std::vector<std::string> delta_filter_datasets;
+
+    /// whether the rows written by each task are recorded for parallel writes
+    bool write_decomposition;
+
+    /// state of an incremental checkpoint update
+    bool checkpoint_active;
+    std::string checkpoint_filename, checkpoint_workname;
+
+    /// deduplication of identical datasets, the index maps the hash of the
+    /// datasets written to the file to their check hash and name
+    bool dedup_active;
+    size_t dedup_min_bytes;
+    std::unordered_multimap<uint64_t, std::pair<uint64_t, std::string>> dedup_index;
+
+    /// staging buffers reused across writes
+    H5StagingPool staging_pool;
+
+    /// pending block of coalesced writes to a dataset, rows [lo,hi) of the
+    /// selection given by start and count in the other dimensions
+    struct _CoalescedWrite
+    {
+        hid_t memtype_id;
+        int rank;
+        std::vector<hsize_t> start, count;
+        hsize_t lo, hi;
+        size_t row_bytes;
+        H5StagingBuffer buf;
+        std::chrono::steady_clock::time_point first_write;
+    };
+    /// coalescing of writes to parts of datasets and its thresholds
+    bool coalesce_active;
+    size_t coalesce_max_bytes, coalesced_bytes;
+    double coalesce_max_seconds;
+    std::map<std::string, _CoalescedWrite> coalesced_writes;
+
+    /// single-writer/multiple-reader access, whether SWMR writing has started
+    /// and the bytes appended and time since the last flush for the flush policy
+    bool swmr_active, swmr_writing;
+    size_t swmr_flush_bytes, swmr_pending_bytes;
+    double swmr_flush_seconds;
+    std::chrono::steady_clock::time_point swmr_last_flush;
+
+    /// group whose particle datasets are written in space-filling-curve order
+    /// and the permutation giving the particle stored at each row
+    std::string spatial_group;
+    std::vector<unsigned long long> spatial_order;
+
 protected:
 
     /// size of chunks when compressing
@@ -84,6 +674,16 @@ protected:
         std::vector<unsigned long long> &mpi_hdf_dims_tot,
         bool flag_parallel, bool flag_first_dim_parallel
     );
+    /// post the non-blocking exchange of the local extents
+    void _post_mpi_dim_and_offset(MPI_Comm &comm,
+        hsize_t rank, const hsize_t *dims, H5MPIDimExchange &exchange,
+        bool flag_parallel);
+    /// wait for the exchange of the local extents and set the offset of this task
+    void _wait_mpi_dim_and_offset(hsize_t rank, const hsize_t *dims,
+        H5MPIDimExchange &exchange, std::vector<unsigned long long> &dims_offset,
+        bool flag_parallel, bool flag_first_dim_parallel);
+    /// create the transfer properties of a parallel write
+    hid_t _create_mpi_transfer_properties(bool flag_collective);
     /// select the hyperslab
     void _set_mpi_hyperslab(hid_t &dspace_id, hid_t &memspace_id,
         hsize_t rank, std::vector<hsize_t> &dims,
@@ -93,7 +693,15 @@ protected:
     void _set_mpi_dataset_properties(hid_t &prop_id, bool &iwrite,
         hid_t &dspace_id, hid_t &memspace_id,
         hsize_t rank, std::vector<hsize_t> dims, std::vector<hsize_t> dims_offset,
-        bool flag_parallel, bool flag_collective, bool flag_hyperslab)
+        bool flag_parallel, bool flag_collective, bool flag_hyperslab);
+    /// move rows between tasks so each task holds whole chunks of the dataset,
+    /// returning the data to write (data itself or buf) and updating the local dims
+    const void *_redistribute_to_chunks(int rank, std::vector<hsize_t> &dims,
+        const void *data, hid_t memtype_id, H5StagingBuffer &buf);
+    /// split the first dimension of a dataset across the tasks, setting the
+    /// local dims and the first row of this task
+    void _split_dataset_rows(H5PathView name, long long nlocal, double weight,
+        std::vector<hsize_t> &dims, hsize_t &row_offset);
 #endif
 
     /// set chunks size for a dataset
@@ -121,24 +729,132 @@ protected:
     }
     hid_t _set_compression(int rank, std::vector<hsize_t> &chunks);
 
+    /// create a dataset ready to be written, setting the data spaces
+    /// and transfer properties, used by write_dataset_nd and write_datasets.
+    /// In parallel the exchange of extents can be posted beforehand by the caller.
+    void _create_dataset_for_write(H5PathView name, int rank, hsize_t *dims,
+        hid_t filetype_id,
+        hid_t &dset_id, hid_t &dspace_id, hid_t &memspace_id, hid_t &prop_id, bool &iwrite,
+        bool flag_parallel, bool flag_first_dim_parallel,
+        bool flag_hyperslab, bool flag_collective
+#ifdef USEPARALLELHDF
+        , H5MPIDimExchange *exchange = NULL
+#endif
+        );
+    /// close ids opened by _create_dataset_for_write
+    void _close_dataset_for_write(hid_t dset_id, hid_t dspace_id,
+        hid_t memspace_id, hid_t prop_id,
+        bool flag_parallel, bool flag_hyperslab);
+
+    /// write the first row and number of rows of each task to name_decomposition
+    void _write_decomposition(H5PathView name, const std::vector<unsigned long long> &counts);
+    /// if recording decompositions, gather the rows supplied by every task for a
+    /// parallel write split along the first dimension and write them
+    void _record_decomposition(H5PathView name, hsize_t nrows_local,
+        bool flag_parallel, bool flag_first_dim_parallel);
+
+    /// check whether every component of a path exists
+    bool _exists_path(H5PathView name);
+    /// create the groups along the path of an object that do not exist yet
+    void _create_parent_groups(H5PathView fullname);
+
+    /// set the checkpoint marker attributes on the root group
+    void _write_checkpoint_marker(int committed, unsigned long long generation);
+    /// hash every chunk of a dataset held in memory
+    void _hash_chunks(std::vector<uint64_t> &hashes, const void *data, size_t elsize,
+        int rank, const hsize_t *dims, const hsize_t *chunks);
+
+    /// compute statistics of data written to a dataset and store them as attributes,
+    /// if flag_accumulate combine with statistics already stored from earlier writes
+    void _write_statistics(H5PathView name, const void *data, hid_t memtype_id,
+        int rank, const hsize_t *dims, bool flag_parallel, bool flag_accumulate);
+
+    /// whether a dataset is selected for the delta filter and has a type it applies to
+    bool _use_delta_filter(H5PathView name, hid_t filetype_id);
+
+    /// write the per-chunk min/max index of a dataset if it has been selected
+    void _write_zone_map(H5PathView name, const void *data, hid_t memtype_id,
+        int rank, const hsize_t *dims, bool flag_parallel);
+    /// read the rows of the zones of a dataset whose range overlaps [lo,hi]
+    /// into buf, returning the first row and number of rows of each run of zones
+    void _read_zones(H5PathView name, double lo, double hi, hid_t memtype_id,
+        std::vector<char> &buf, std::vector<hsize_t> &run_start, std::vector<hsize_t> &run_count,
+        hsize_t &row_size);
+    /// read runs of rows of a dataset (given by first row and number of rows,
+    /// in increasing order) into buf with one read, setting the size of a row
+    void _read_row_runs(H5PathView name, hid_t memtype_id,
+        const std::vector<hsize_t> &run_start, const std::vector<hsize_t> &run_count,
+        std::vector<char> &buf, hsize_t &row_size);
+
+    /// select the given distinct rows, in increasing order, on the file space of
+    /// a dataset, returning the file space and setting the size of a row
+    hid_t _select_element_rows(hid_t dset_id, H5PathView name,
+        const std::vector<hsize_t> &rows, hsize_t &row_size);
+
+    /// sort particles by the Morton key of their positions and write the spatial index
+    void _begin_spatial_order(const std::string &group, hsize_t n, const void *pos,
+        hid_t memtype_id, const double *box_min, double box_size, unsigned int index_level,
+        bool flag_parallel, bool flag_collective);
+    /// return data permuted into buf in space-filling-curve order if the dataset
+    /// belongs to the spatially ordered group, otherwise data itself
+    const void *_apply_spatial_order(H5PathView name, const void *data,
+        hid_t memtype_id, int rank, const hsize_t *dims, H5StagingBuffer &buf);
+
+    /// add a write of a hyperslab to the pending block of the dataset,
+    /// returning false if the write cannot be coalesced
+    bool _coalesce_write(H5PathView name, int rank, const hsize_t *dims,
+        const void *data, const std::vector<hsize_t> &count, const std::vector<hsize_t> &start,
+        hid_t memtype_id);
+    /// write the pending block of a dataset, or of all datasets
+    void _flush_coalesced(H5PathView name);
+    void _flush_coalesced();
+
+    /// file access properties for create() and append(), the latest library
+    /// version bounds if SWMR is used (to be closed if not H5P_DEFAULT)
+    hid_t _file_access_plist();
+    /// flush if the bytes appended or the time since the last flush pass the SWMR policy
+    void _swmr_flush_policy(size_t nbytes);
+
+    /// hashes identifying the contents, type and shape of a dataset
+    struct _DedupKey
+    {
+        uint64_t hash, check;
+        bool ivalid = false;
+    };
+    /// if deduplicating and an identical dataset was written earlier create name
+    /// as a hard link to it and return true, otherwise set the key to record
+    /// once the dataset has been written
+    bool _dedup_lookup(H5PathView name, const void *data,
+        hid_t memtype_id, hid_t filetype_id, int rank, const hsize_t *dims,
+        bool flag_parallel, _DedupKey &key);
+    void _dedup_record(H5PathView name, const _DedupKey &key);
+
+    /// open a dataset for a DatasetView with a tuned chunk cache, setting the
+    /// dimensions of the blocks the view reads
+    hid_t _open_dataset_view(const std::string &name, size_t elsize, std::vector<hsize_t> &block_dims);
+
+    /// create the group of a ragged array and write its offsets,
+    /// returning the number of values local to this task
+    hsize_t _write_ragged_offsets(H5PathView name,
+        hsize_t nelem, const unsigned long long *counts,
+        bool flag_parallel, bool flag_collective);
+
     /// tokenize a path given an input string
     std::vector<std::string> _tokenize(const std::string &s);
 
+    /// open an attribute given by the path of its object and its name,
+    /// throwing std::invalid_argument if it does not exist
+    hid_t _open_attribute(H5PathView name);
     /// get attribute id
     void _get_attribute(std::vector<hid_t> &ids, const std::string attr_name);
     /// get attribute id from tokenized string
     void _get_attribute(std::vector<hid_t> &ids, const std::vector<std::string> &parts);
 
     /// wrapper for reading scalar
+    /// (strings are handled by the specialisation following the class)
     template<typename T> void _do_read(const hid_t &attr, const hid_t &type, T &val)
     {
-        if (hdf5_type(T{}) == H5T_C_S1)
-        {
-          _do_read_string(attr, type, val);
-        }
-        else {
-          H5Aread(attr, type, &val);
-        }
+        H5Aread(attr, type, &val);
     }
     /// wrapper for reading string
     void _do_read_string(const hid_t &attr, const hid_t &type, std::string &val);
@@ -175,9 +891,327 @@ public:
     /// Append to a file
     void append(std::string filename, hid_t flag = H5F_ACC_RDWR,
         int taskID = -1, bool iparallelopen = true);
+    /// id of the open file, for HDF5 calls the wrapper does not cover
+    hid_t get_file_id() const
+    {
+        return file_id;
+    }
 
     /// Close the file
     void close();
+    /// Write any coalesced writes and flush the file
+    void flush();
+
+    /// Use single-writer/multiple-reader access for files opened next with
+    /// create() or append() (serial access only). The file is opened with the
+    /// latest library version bounds, the appendable datasets are created and
+    /// start_swmr_write() then lets readers opened with open_swmr_read() follow
+    /// the rows added with append_to_dataset(). No objects or attributes can be
+    /// created once SWMR writing has started. The file is flushed, making the
+    /// rows visible to readers, once flush_bytes have been appended or the last
+    /// flush is flush_seconds old (checked on each append), a zero disabling
+    /// either, and on flush() and close().
+    void set_swmr(bool flag_swmr, size_t flush_bytes = 16*1024*1024, double flush_seconds = 1.0)
+    {
+        swmr_active = flag_swmr;
+        swmr_flush_bytes = flush_bytes;
+        swmr_flush_seconds = flush_seconds;
+    }
+    /// Start SWMR writing of a file opened with create() or append() after set_swmr()
+    void start_swmr_write();
+    /// Open a file written with SWMR for reading while it is written. Reads see
+    /// the rows flushed by the writer, refresh_dataset() updates the extent.
+    void open_swmr_read(std::string filename);
+    /// reload the metadata of a dataset of a file opened with open_swmr_read(),
+    /// returning the number of rows along the first dimension visible
+    hsize_t refresh_dataset(const std::string &name);
+
+    /// Create a dataset that grows along the first dimension with
+    /// append_to_dataset(), dims giving the initial extent (usually no rows).
+    /// The dataset is chunked with chunk_rows rows per chunk, by default
+    /// HDFOUTPUTCHUNKSIZE rows.
+    void create_appendable_dataset(const std::string &name, int rank, const hsize_t *dims,
+        hid_t filetype_id, hsize_t chunk_rows = 0);
+    template <typename T> void create_appendable_dataset(const std::string &name, H5Dims dims,
+        hsize_t chunk_rows = 0)
+    {
+        create_appendable_dataset(name, dims.size(), dims.data(), hdf5_type(T{}), chunk_rows);
+    }
+    /// Append nrows rows to a dataset made with create_appendable_dataset(),
+    /// extending it along the first dimension
+    void append_to_dataset(H5PathView name, hsize_t nrows, const void *data, hid_t memtype_id);
+    template <typename T> void append_to_dataset(H5PathView name, hsize_t nrows, const T *data)
+    {
+        append_to_dataset(name, nrows, (const void*)data, hdf5_type(T{}));
+    }
+
+    /// Coalesce writes made with write_to_dataset_nd to a file opened by this
+    /// task alone, whatever their flag_parallel; writes to a file opened in
+    /// parallel through MPI-IO are never coalesced. Writes to a dataset
+    /// whose rows are adjacent to or overlap the pending rows, with the same
+    /// selection in the other dimensions, are merged and written as one write
+    /// once max_bytes are pending across datasets, the oldest pending write is
+    /// max_seconds old (checked on each write), another part of the dataset is
+    /// written, or on flush() and close(). Reads through this class flush the
+    /// dataset read first.
+    void set_write_coalescing(bool flag_coalesce, size_t max_bytes = 64*1024*1024,
+        double max_seconds = 1.0)
+    {
+        if (!flag_coalesce) _flush_coalesced();
+        coalesce_active = flag_coalesce;
+        coalesce_max_bytes = max_bytes;
+        coalesce_max_seconds = max_seconds;
+    }
+
+    /// Opt in to deduplication. A dataset written with write_dataset_nd or
+    /// write_datasets whose contents, type and shape match a dataset written
+    /// earlier to the same file is created as a hard link to it instead of being
+    /// written again. Datasets smaller than min_bytes are always written.
+    /// Attributes added later to either name are shared as it is one object.
+    void set_deduplication(bool flag_dedup, size_t min_bytes = 4096)
+    {
+        dedup_active = flag_dedup;
+        dedup_min_bytes = min_bytes;
+    }
+
+    /// Limit the memory kept by the staging buffers of the writes to nbytes
+    void set_staging_high_water_mark(size_t nbytes)
+    {
+        staging_pool.set_high_water_mark(nbytes);
+    }
+    /// memory held by the staging buffers
+    H5StagingStatistics staging_statistics() const
+    {
+        return staging_pool.statistics();
+    }
+    /// free the staging buffers not in use
+    void release_staging_buffers()
+    {
+        staging_pool.trim();
+    }
+
+    /// Compute min, max, sum, NaN count and optionally a histogram with nbins
+    /// of the data passed to the write calls while it is still in cache,
+    /// storing them as attributes of the dataset (reduced across tasks in parallel).
+    /// The histogram covers [histogram_min, histogram_max] if histogram_max >
+    /// histogram_min and the range of the data otherwise. Writes to part of a
+    /// dataset (write_to_dataset_nd, streamed and coalesced writes) accumulate
+    /// the statistics. With the range of the data the histogram of earlier
+    /// pieces is rebinned to the range of all the data written so far, each
+    /// earlier bin counted where its centre falls, so give an explicit range
+    /// for exact histograms of data written in pieces. min and max are NaN if
+    /// no values other than NaN were written.
+    void set_write_statistics(bool flag_statistics, unsigned int nbins = 0,
+        double histogram_min = 0, double histogram_max = 0)
+    {
+        write_statistics = flag_statistics;
+        statistics_nbins = nbins;
+        statistics_histogram_min = histogram_min;
+        statistics_histogram_max = histogram_max;
+    }
+    /// read the statistics stored with a dataset
+    H5DatasetStatistics read_statistics(H5PathView name);
+
+    /// Select datasets for which a zone map, the min and max of every chunk
+    /// along the first dimension, is written to the dataset name_zonemap
+    /// when the dataset is written with write_dataset_nd, from a template or
+    /// not, or write_datasets.
+    void set_zone_map_datasets(std::vector<std::string> names)
+    {
+        zone_map_datasets = names;
+    }
+    /// Select 32 and 64 bit integer datasets, such as sorted IDs and offsets,
+    /// stored chunked with the delta filter when created by write_dataset_nd,
+    /// write_datasets or create_appendable_dataset. Such datasets can only be
+    /// read through the wrapper, see H5Z_FILTER_HDF5WRAPPER_DELTA.
+    void set_delta_filter_datasets(std::vector<std::string> names)
+    {
+        delta_filter_datasets = names;
+    }
+    /// Read the values of a dataset in [lo,hi] along with their flattened
+    /// indices. Only zones whose range overlaps the predicate are read if the
+    /// dataset has a zone map, otherwise the whole dataset is scanned.
+    template <typename T> void read_where(H5PathView name, double lo, double hi,
+        std::vector<T> &values, std::vector<unsigned long long> &indices)
+    {
+        std::vector<char> buf;
+        std::vector<hsize_t> run_start, run_count;
+        hsize_t row_size;
+        _read_zones(name, lo, hi, hdf5_type(T{}), buf, run_start, run_count, row_size);
+        const T *data = (const T *)buf.data();
+        values.clear();
+        indices.clear();
+        for (hsize_t irun=0;irun<run_start.size();irun++) {
+            unsigned long long first = run_start[irun] * row_size;
+            unsigned long long n = run_count[irun] * row_size;
+            for (hsize_t i=0;i<n;i++) {
+                if (data[i] >= lo && data[i] <= hi) {
+                    values.push_back(data[i]);
+                    indices.push_back(first + i);
+                }
+            }
+            data += n;
+        }
+    }
+
+    /// Write the particles of a group in space-filling-curve order. The n
+    /// positions (n x 3) are sorted by their Morton key in the cube of side
+    /// box_size starting at box_min and, until end_spatial_order, every dataset
+    /// group/name written with write_dataset_nd or write_datasets with n rows
+    /// is permuted into that order. The index group/spatial_index holds the
+    /// offset of the first particle of every cell of a grid of 2^index_level
+    /// cells per side, with a row of offsets per task in parallel as every
+    /// task sorts its own particles.
+    template <typename T> void begin_spatial_order(std::string group, hsize_t n, const T *pos,
+        const double *box_min, double box_size, unsigned int index_level = 5,
+        bool flag_parallel = true, bool flag_collective = true)
+    {
+        _begin_spatial_order(group, n, pos, hdf5_type(T{}), box_min, box_size, index_level,
+            flag_parallel, flag_collective);
+    }
+    /// stop permuting datasets written to the spatially ordered group
+    void end_spatial_order()
+    {
+        spatial_group.clear();
+        spatial_order.clear();
+    }
+    /// Find the rows of a spatially ordered group in the cells overlapping the
+    /// box [lo,hi], as runs of contiguous rows given by first row and count.
+    /// The runs can hold particles just outside the box as whole cells are returned.
+    void read_region(const std::string &group, const double *lo, const double *hi,
+        std::vector<hsize_t> &run_start, std::vector<hsize_t> &run_count);
+    /// read runs of rows of a dataset, such as those found by read_region, with a single read
+    template <typename T> void read_rows(H5PathView name,
+        const std::vector<hsize_t> &run_start, const std::vector<hsize_t> &run_count,
+        std::vector<T> &data)
+    {
+        std::vector<char> buf;
+        hsize_t row_size;
+        _read_row_runs(name, hdf5_type(T{}), run_start, run_count, buf, row_size);
+        data.resize(buf.size() / sizeof(T));
+        if (buf.size() > 0) std::memcpy(data.data(), buf.data(), buf.size());
+    }
+
+    /// Write the rows of an existing dataset at the given indices along the first
+    /// dimension, data holding one row per index in the order of the indices.
+    /// The rows are written in file order with a single write, if an index is
+    /// repeated the last of its rows is written.
+    void write_elements(H5PathView name, const std::vector<hsize_t> &indices,
+        const void *data, hid_t memtype_id);
+    template <typename T> void write_elements(H5PathView name, const std::vector<hsize_t> &indices,
+        const T *data)
+    {
+        write_elements(name, indices, (const void*)data, hdf5_type(T{}));
+    }
+    /// Read the rows of a dataset at the given indices along the first dimension
+    /// into data in the order of the indices with a single read in file order
+    void read_elements(H5PathView name, const std::vector<hsize_t> &indices,
+        void *data, hid_t memtype_id);
+    template <typename T> void read_elements(H5PathView name, const std::vector<hsize_t> &indices,
+        T *data)
+    {
+        read_elements(name, indices, (void*)data, hdf5_type(T{}));
+    }
+
+    /// Record for every dataset written in parallel with write_dataset_nd,
+    /// write_datasets or a template the first row and number of rows supplied
+    /// by each task, before any redistribution to whole chunks, in the dataset
+    /// name_decomposition so that a restart on a different number of tasks can
+    /// follow the decomposition.
+    void set_write_decomposition(bool flag_decomposition)
+    {
+        write_decomposition = flag_decomposition;
+    }
+    /// read the first row and number of rows written by each task, returns
+    /// false if no decomposition was recorded for the dataset
+    bool read_decomposition(H5PathView name,
+        std::vector<unsigned long long> &offsets, std::vector<unsigned long long> &counts);
+    /// Rows of a dataset read by task itask of ntasks on restart, a contiguous
+    /// run made of whole blocks of the writing tasks if there are no more tasks
+    /// than wrote the dataset, otherwise part of one block cut at chunk boundaries
+    void restart_rows(H5PathView name, int ntasks, int itask,
+        hsize_t &row_offset, hsize_t &nrows);
+
+#ifdef USEPARALLELHDF
+    /// Read a dataset split along the first dimension across the tasks with one
+    /// collective read, the read-side counterpart of the offsets set for parallel
+    /// writes. The rows are split evenly unless every task passes the number of
+    /// rows it wants (nlocal >= 0, summing to the rows of the dataset) or its
+    /// weight (weight >= 0), tasks getting consecutive rows in task order.
+    /// Must be called by all tasks. The untyped version reads the local extent
+    /// dims starting at row_offset, the typed one works these out and sets dims.
+    void read_dataset_distributed(H5PathView name, void *data,
+        const std::vector<hsize_t> &dims, hsize_t row_offset, hid_t memtype_id,
+        bool flag_collective = true);
+    template <typename T> void read_dataset_distributed(H5PathView name,
+        std::vector<T> &data, std::vector<hsize_t> &dims,
+        long long nlocal = -1, double weight = -1, bool flag_collective = true)
+    {
+        hsize_t row_offset, n = 1;
+        _split_dataset_rows(name, nlocal, weight, dims, row_offset);
+        for (auto &d:dims) n *= d;
+        data.resize(n);
+        read_dataset_distributed(name, data.data(), dims, row_offset, hdf5_type(T{}), flag_collective);
+    }
+    /// Read the rows of a dataset for this task on a restart, split according to
+    /// the decomposition recorded when it was written (see restart_rows)
+    template <typename T> void read_dataset_restart(H5PathView name,
+        std::vector<T> &data, std::vector<hsize_t> &dims, bool flag_collective = true)
+    {
+        hsize_t row_offset, nrows, n = 1;
+        restart_rows(name, NProcsWrite, ThisWriteTask, row_offset, nrows);
+        hid_t dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+        hid_t dspace_id = H5Dget_space(dset_id);
+        dims.resize(H5Sget_simple_extent_ndims(dspace_id));
+        H5Sget_simple_extent_dims(dspace_id, dims.data(), NULL);
+        H5Sclose(dspace_id);
+        H5Dclose(dset_id);
+        dims[0] = nrows;
+        for (auto &d:dims) n *= d;
+        data.resize(n);
+        read_dataset_distributed(name, data.data(), dims, row_offset, hdf5_type(T{}), flag_collective);
+    }
+#endif
+
+    /// Open a dataset as a lazily read, array-like DatasetView keeping up to
+    /// cache_bytes of blocks in memory. The HDF5 chunk cache of the dataset is
+    /// sized for reads of whole chunks as the view already caches decoded chunks.
+    template <typename T> DatasetView<T> open_dataset_view(const std::string &name,
+        size_t cache_bytes = 64*1024*1024)
+    {
+        std::vector<hsize_t> block_dims;
+        hid_t dset_id = _open_dataset_view(name, sizeof(T), block_dims);
+        size_t block_bytes = sizeof(T);
+        for (auto &d:block_dims) block_bytes *= d;
+        return DatasetView<T>(dset_id, block_dims, cache_bytes / block_bytes);
+    }
+
+    /// Begin an incremental update of a checkpoint file, opened with append().
+    /// By default (flag_copy) the update is made to a copy of the file which
+    /// replaces the original on commit_checkpoint, so the update is atomic and
+    /// a crash leaves the previous checkpoint intact. The copy is a clone
+    /// sharing the blocks of the original where the file system supports it,
+    /// otherwise a full copy of the file. Without flag_copy the file is updated
+    /// in place, avoiding the copy, and the checkpoint_committed attribute of
+    /// the root group is zero until the update is committed; an interrupted
+    /// update is then only detected on restart and leaves no valid checkpoint.
+    void begin_checkpoint(std::string filename, bool flag_copy = true,
+        int taskID = -1, bool iparallelopen = true);
+    /// Write a full dataset to the checkpoint. Each chunk is hashed and
+    /// compared with the hashes stored from the previous checkpoint in the
+    /// companion dataset name_chunkhash, only chunks that changed are written.
+    /// The data held by this task is taken to be the whole dataset.
+    void write_checkpoint_dataset_nd(H5PathView name, int rank, hsize_t *dims, void *data,
+        hid_t memtype_id, hid_t filetype_id = -1);
+    template <typename T> void write_checkpoint_dataset_nd(H5PathView name, H5Dims dims,
+        T *data, hid_t filetype_id = -1)
+    {
+        write_checkpoint_dataset_nd(name, dims.size(), dims.data(), (void*)data,
+            hdf5_type(T{}), filetype_id);
+    }
+    /// mark the checkpoint as complete, close it and if working on a copy
+    /// rename it over the original
+    void commit_checkpoint();
 
     /// create a group
     hid_t create_group(std::string groupname) {
@@ -247,28 +1281,32 @@ public:
           H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
         return dset_id;
     }
-    /// create data set and return hid
-    /// and possibly close all groups, data spaces and data set itself after creation
-    template <typename T> hid_t create_dataset(std::string path, std::string name, T&data,
-        std::vector<hsize_t> dims, std::vector<hsize_t> chunkDims = std::vector<hsize_t>(0),
+    /// create data set and return hid, creating any missing groups along the path,
+    /// and possibly close the data set itself after creation.
+    /// Paths and dimensions are passed as views and in-place arrays so that
+    /// creating a dataset does not allocate for them.
+    template <typename T> hid_t create_dataset(H5PathView path, H5PathView name, T&data,
+        H5Dims dims, H5Dims chunkDims = H5Dims(),
         bool flag_closedataset = true,
         bool flag_parallel = true, bool flag_hyperslab = true, bool flag_collective = true)
     {
-        return create_dataset(path+"/"+name, hdf5_type(T{}), dims, chunkDims,
+        H5PathBuffer fullname(path, name);
+        return create_dataset(H5PathView(fullname.c_str(), fullname.size()), hdf5_type(T{}), dims, chunkDims,
             flag_closedataset,
             flag_parallel, flag_hyperslab, flag_collective);
     }
-    hid_t create_dataset(std::string path, std::string name, hid_t datatype,
-        std::vector<hsize_t> dims, std::vector<hsize_t> chunkDims = std::vector<hsize_t>(0),
+    hid_t create_dataset(H5PathView path, H5PathView name, hid_t datatype,
+        H5Dims dims, H5Dims chunkDims = H5Dims(),
         bool flag_closedataset = true,
         bool flag_parallel = true, bool flag_hyperslab = true, bool flag_collective = true)
     {
-        return create_dataset(path+"/"+name, datatype, dims, chunkDims,
+        H5PathBuffer fullname(path, name);
+        return create_dataset(H5PathView(fullname.c_str(), fullname.size()), datatype, dims, chunkDims,
             flag_closedataset,
             flag_parallel, flag_hyperslab, flag_collective);
     }
-    template <typename T> hid_t create_dataset(std::string fullname, T&data,
-        std::vector<hsize_t> dims, std::vector<hsize_t> chunkDims = std::vector<hsize_t>(0),
+    template <typename T> hid_t create_dataset(H5PathView fullname, T&data,
+        H5Dims dims, H5Dims chunkDims = H5Dims(),
         bool flag_closedataset = true,
         bool flag_parallel = true, bool flag_hyperslab = true, bool flag_collective = true)
     {
@@ -276,10 +1314,24 @@ public:
             flag_closedataset,
             flag_parallel, flag_hyperslab, flag_collective);
     }
-    hid_t create_dataset(std::string fullname, hid_t datatype,
-      std::vector<hsize_t> dims, std::vector<hsize_t> chunkDims = std::vector<hsize_t>(0),
+    hid_t create_dataset(H5PathView fullname, hid_t datatype,
+      H5Dims dims, H5Dims chunkDims = H5Dims(),
       bool flag_closedataset = true,
       bool flag_parallel = true, bool flag_hyperslab = true, bool flag_collective = true);
+    /// create data set from a template, reusing its property list and data space
+    hid_t create_dataset(H5PathView fullname, const DatasetTemplate &tmpl,
+        bool flag_closedataset = true);
+
+    /// Build a dataset template. If chunkDims is empty the default chunking
+    /// policy is used and if no layout is given it is chunked when there are
+    /// chunks and contiguous otherwise. In parallel the offsets of the local data are
+    /// exchanged once here rather than for every dataset written.
+    DatasetTemplate create_dataset_template(hid_t filetype_id,
+        std::vector<hsize_t> dims, std::vector<hsize_t> chunkDims = std::vector<hsize_t>(0),
+        int deflate_level = 0, bool shuffle = false,
+        H5D_layout_t layout = H5D_LAYOUT_ERROR,
+        bool flag_parallel = true, bool flag_first_dim_parallel = true,
+        bool flag_hyperslab = true, bool flag_collective = true);
 
     /// close data set
     herr_t close_dataset(hid_t dset_id) {
@@ -298,12 +1350,12 @@ public:
 
     /// writes to an existing data set
     /// with a hyperslab selection defined by count, start
-    void write_to_dataset(std::string name, hsize_t len, void *data,
+    void write_to_dataset(H5PathView name, hsize_t len, void *data,
         const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
         hid_t memtype_id=-1, hid_t filetype_id=-1,
         bool flag_parallel = true, bool flag_first_dim_parallel = true,
         bool flag_hyperslab = true, bool flag_collective = true);
-    template <typename T> void write_to_dataset(std::string name, hsize_t len, T *data,
+    template <typename T> void write_to_dataset(H5PathView name, hsize_t len, T *data,
         const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
         hid_t memtype_id = -1, hid_t filetype_id=-1,
         bool flag_parallel = true, bool flag_hyperslab = true, bool flag_collective = true)
@@ -317,7 +1369,7 @@ public:
     }
     /// Write a multidimensional dataset. Data type of the new dataset is taken to be the type of
     /// the input data if not explicitly specified with the filetype_id parameter.
-    template <typename T> void write_to_dataset_nd(std::string name, int rank, hsize_t *dims, T *data,
+    template <typename T> void write_to_dataset_nd(H5PathView name, int rank, hsize_t *dims, T *data,
         const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
         hid_t memtype_id = -1, hid_t filetype_id = -1,
         bool flag_parallel = true, bool flag_first_dim_parallel = true,
@@ -330,7 +1382,7 @@ public:
             flag_parallel, flag_first_dim_parallel,
             flag_hyperslab, flag_collective);
     }
-    template <typename T> void write_to_dataset_nd(std::string name, std::vector<hsize_t> dims, T *data,
+    template <typename T> void write_to_dataset_nd(H5PathView name, H5Dims dims, T *data,
         const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
         hid_t memtype_id = -1, hid_t filetype_id = -1,
         bool flag_parallel = true, bool flag_first_dim_parallel = true,
@@ -343,7 +1395,7 @@ public:
             flag_hyperslab, flag_collective);
     }
     //write dataset with hyperslab selection
-    void write_to_dataset_nd(std::string name, int rank, hsize_t *dims, void *data,
+    void write_to_dataset_nd(H5PathView name, int rank, hsize_t *dims, void *data,
         const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
         hid_t memtype_id = -1, hid_t filetype_id=-1,
         bool flag_parallel = true, bool flag_first_dim_parallel = true,
@@ -351,16 +1403,16 @@ public:
 
     /// write 1D data sets of string or input data with defined data type
     /// without hyperslab selection, creates dataset, writes to it and closes
-    void write_dataset(std::string name, hsize_t len, std::string data,
+    void write_dataset(H5PathView name, hsize_t len, std::string data,
         bool flag_parallel = true, bool flag_collective = true);
-    void write_dataset(std::string name, hsize_t len, void *data,
+    void write_dataset(H5PathView name, hsize_t len, void *data,
         hid_t memtype_id=-1, hid_t filetype_id=-1,
         bool flag_parallel = true, bool flag_first_dim_parallel = true,
         bool flag_hyperslab = true, bool flag_collective = true);
     /// Write a new 1D dataset. Data type of the new dataset is taken to be the type of
     /// the input data if not explicitly specified with the filetype_id parameter.
     /// template function so defined here
-    template <typename T> void write_dataset(std::string name, hsize_t len, T *data,
+    template <typename T> void write_dataset(H5PathView name, hsize_t len, T *data,
         hid_t memtype_id = -1, hid_t filetype_id=-1,
         bool flag_parallel = true, bool flag_hyperslab = true, bool flag_collective = true)
     {
@@ -371,7 +1423,7 @@ public:
     }
     /// Write a multidimensional dataset. Data type of the new dataset is taken to be the type of
     /// the input data if not explicitly specified with the filetype_id parameter.
-    template <typename T> void write_dataset_nd(std::string name, int rank, hsize_t *dims, T *data,
+    template <typename T> void write_dataset_nd(H5PathView name, int rank, hsize_t *dims, T *data,
         hid_t memtype_id = -1, hid_t filetype_id = -1,
         bool flag_parallel = true, bool flag_first_dim_parallel = true,
         bool flag_hyperslab = true, bool flag_collective = true)
@@ -447,7 +1499,7 @@ public:
 //         H5Sclose(dspace_id);
 //         H5Dclose(dset_id);
     }
-    template <typename T> void write_dataset_nd(std::string name, std::vector<hsize_t> dims, T *data,
+    template <typename T> void write_dataset_nd(H5PathView name, H5Dims dims, T *data,
         hid_t memtype_id = -1, hid_t filetype_id = -1,
         bool flag_parallel = true, bool flag_first_dim_parallel = true,
         bool flag_hyperslab = true, bool flag_collective = true)
@@ -458,16 +1510,24 @@ public:
             flag_hyperslab, flag_collective);
     }
     //write dataset with hyperslab selection
-    void write_dataset_nd(std::string name, int rank, hsize_t *dims, void *data,
+    void write_dataset_nd(H5PathView name, int rank, hsize_t *dims, void *data,
         hid_t memtype_id = -1, hid_t filetype_id=-1,
         bool flag_parallel = true, bool flag_first_dim_parallel = true,
         bool flag_hyperslab = true, bool flag_collective = true);
 
+    /// Write a dataset described by a template, only the dataset itself is created
+    void write_dataset_nd(H5PathView name, const DatasetTemplate &tmpl, void *data,
+        hid_t memtype_id);
+    template <typename T> void write_dataset_nd(H5PathView name, const DatasetTemplate &tmpl, T *data)
+    {
+        write_dataset_nd(name, tmpl, (void*)data, hdf5_type(T{}));
+    }
+
     /// with a hyperslab selection defined by count, start
-    void write_dataset(std::string name, hsize_t len, std::string data,
+    void write_dataset(H5PathView name, hsize_t len, std::string data,
         const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
         bool flag_parallel = true, bool flag_collective = true);
-    void write_dataset(std::string name, hsize_t len, void *data,
+    void write_dataset(H5PathView name, hsize_t len, void *data,
         const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
         hid_t memtype_id=-1, hid_t filetype_id=-1,
         bool flag_parallel = true, bool flag_first_dim_parallel = true,
@@ -475,7 +1535,7 @@ public:
     /// Write a new 1D dataset. Data type of the new dataset is taken to be the type of
     /// the input data if not explicitly specified with the filetype_id parameter.
     /// template function so defined here
-    template <typename T> void write_dataset(std::string name, hsize_t len, T *data,
+    template <typename T> void write_dataset(H5PathView name, hsize_t len, T *data,
         const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
         hid_t memtype_id = -1, hid_t filetype_id=-1,
         bool flag_parallel = true, bool flag_hyperslab = true, bool flag_collective = true)
@@ -490,7 +1550,7 @@ public:
 
     /// Write a multidimensional dataset. Data type of the new dataset is taken to be the type of
     /// the input data if not explicitly specified with the filetype_id parameter.
-    template <typename T> void write_dataset_nd(std::string name, std::vector<hsize_t> dims, T *data,
+    template <typename T> void write_dataset_nd(H5PathView name, H5Dims dims, T *data,
         const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
         hid_t memtype_id = -1, hid_t filetype_id = -1,
         bool flag_parallel = true, bool flag_first_dim_parallel = true,
@@ -502,7 +1562,7 @@ public:
             flag_parallel, flag_first_dim_parallel,
             flag_hyperslab, flag_collective);
     }
-    template <typename T> void write_dataset_nd(std::string name, int rank, hsize_t *dims, T *data,
+    template <typename T> void write_dataset_nd(H5PathView name, int rank, hsize_t *dims, T *data,
         const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
         hid_t memtype_id = -1, hid_t filetype_id = -1,
         bool flag_parallel = true, bool flag_first_dim_parallel = true,
@@ -549,7 +1609,7 @@ public:
     prop_id = _set_compression(rank, chunks);
 #endif
     // Create the dataset
-    dset_id = H5Dcreate(file_id, name.c_str(), filetype_id, dspace_id,
+    dset_id = H5Dcreate(file_id, H5PathBuffer(name).c_str(), filetype_id, dspace_id,
         H5P_DEFAULT, prop_id, H5P_DEFAULT);
     if(dset_id < 0) io_error(std::string("Failed to create dataset: ")+name);
     H5Pclose(prop_id);
@@ -579,66 +1639,159 @@ public:
     H5Dclose(dset_id);
     }
 
-    void write_dataset_nd(std::string name, int rank, hsize_t *dims, void *data,
+    void write_dataset_nd(H5PathView name, int rank, hsize_t *dims, void *data,
         const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
         hid_t memtype_id = -1, hid_t filetype_id=-1,
         bool flag_parallel = true, bool flag_first_dim_parallel = true,
         bool flag_hyperslab = true, bool flag_collective = true);
 
+    /// Create and write several datasets in one call. All datasets are created
+    /// first and then written together with H5Dwrite_multi (HDF5 >= 1.14),
+    /// aggregating the I/O, or one after another for older versions.
+    void write_datasets(std::vector<H5DatasetWrite> &dsets,
+        bool flag_parallel = true, bool flag_first_dim_parallel = true,
+        bool flag_hyperslab = true, bool flag_collective = true);
+
+    /// Create a dataset and write it slab by slab, runs of slab_rows rows along
+    /// the first dimension (whole chunks, by default about 64 MiB), pulling each
+    /// slab from the producer so that the whole dataset is never held in memory.
+    /// If flag_double_buffer and built with OpenMP, the next slab is produced
+    /// while the current one is written. Serial only, each call writing a
+    /// dataset of its own.
+    void write_dataset_streamed(H5PathView name, int rank, hsize_t *dims,
+        const H5SlabProducer &producer, hid_t memtype_id, hid_t filetype_id = -1,
+        hsize_t slab_rows = 0, bool flag_double_buffer = true);
+    template <typename T> void write_dataset_streamed(H5PathView name, H5Dims dims,
+        const H5SlabProducer &producer, hid_t filetype_id = -1,
+        hsize_t slab_rows = 0, bool flag_double_buffer = true)
+    {
+        write_dataset_streamed(name, dims.size(), dims.data(), producer,
+            hdf5_type(T{}), filetype_id, slab_rows, flag_double_buffer);
+    }
+    /// stream a dataset from an input iterator over its elements in row-major order
+    template <typename Iterator> void write_dataset_streamed(H5PathView name,
+        H5Dims dims, Iterator first, hid_t filetype_id = -1,
+        hsize_t slab_rows = 0, bool flag_double_buffer = true)
+    {
+        typedef typename std::iterator_traits<Iterator>::value_type T;
+        hsize_t row_size = 1;
+        for (auto i=1;i<dims.size();i++) row_size *= dims[i];
+        H5SlabProducer producer = [&first, row_size](hsize_t row_start, hsize_t nrows, void *buf)
+        {
+            T *out = (T *)buf;
+            for (hsize_t i=0;i<nrows*row_size;i++, ++first) out[i] = *first;
+        };
+        write_dataset_streamed(name, dims.size(), dims.data(), producer,
+            hdf5_type(T{}), filetype_id, slab_rows, flag_double_buffer);
+    }
+
+    /// Create a deflate compressed dataset and write it deciding for every chunk
+    /// whether it is worth compressing. The order-0 entropy of a sample of each
+    /// chunk (of every byte of the elements separately if shuffled) estimates
+    /// the compression ratio, chunks not expected to shrink below max_ratio of
+    /// their size are stored raw with H5Dwrite_chunk and their filters marked
+    /// as skipped in the filter mask, the others go through the filter pipeline.
+    /// Chunks hold chunk_rows whole rows, HDFOUTPUTCHUNKSIZE by default. Serial only,
+    /// the data held by this task is taken to be the whole dataset. Returns the
+    /// number of chunks stored raw.
+    hsize_t write_dataset_adaptive(H5PathView name, int rank, hsize_t *dims,
+        const void *data, hid_t memtype_id, hid_t filetype_id = -1,
+        int deflate_level = 6, bool shuffle = true, double max_ratio = 0.9,
+        hsize_t chunk_rows = 0);
+    template <typename T> hsize_t write_dataset_adaptive(H5PathView name, H5Dims dims,
+        const T *data, hid_t filetype_id = -1, int deflate_level = 6, bool shuffle = true,
+        double max_ratio = 0.9, hsize_t chunk_rows = 0)
+    {
+        return write_dataset_adaptive(name, dims.size(), dims.data(), (const void*)data,
+            hdf5_type(T{}), filetype_id, deflate_level, shuffle, max_ratio, chunk_rows);
+    }
+
+    /// reads from an existing data set with a hyperslab selection defined by count, start.
+    /// If count and start are empty the entire data set is read.
+    void read_from_dataset_nd(H5PathView name, void *data,
+        const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
+        hid_t memtype_id);
+    template <typename T> void read_from_dataset_nd(H5PathView name, T *data,
+        const std::vector<hsize_t>& count, const std::vector<hsize_t>& start,
+        hid_t memtype_id = -1)
+    {
+        if (memtype_id == -1) memtype_id = hdf5_type(T{});
+        read_from_dataset_nd(name, (void*)data, count, start, memtype_id);
+    }
+
+    /// Write a ragged array, a variable length list per element, as a group
+    /// holding the concatenated values and the prefix-sum offsets
+    /// (nelem+1 entries) so that list i is values[offsets[i]:offsets[i+1]].
+    /// In parallel the offsets are global, each task writing its own lists.
+    template <typename T> void write_ragged_dataset(H5PathView name,
+        hsize_t nelem, const unsigned long long *counts, T *values,
+        hid_t filetype_id = -1,
+        bool flag_parallel = true, bool flag_collective = true)
+    {
+        hsize_t dims[1];
+        dims[0] = _write_ragged_offsets(name, nelem, counts, flag_parallel, flag_collective);
+        write_dataset_nd(name+"/values", 1, dims, values,
+            hdf5_type(T{}), filetype_id,
+            flag_parallel, true, true, flag_collective);
+    }
+    template <typename T> void write_ragged_dataset(H5PathView name,
+        const std::vector<std::vector<T>> &data,
+        hid_t filetype_id = -1,
+        bool flag_parallel = true, bool flag_collective = true)
+    {
+        std::vector<unsigned long long> counts(data.size());
+        std::vector<T> values;
+        unsigned long long nvalues = 0;
+        for (auto i=0;i<data.size();i++) {
+            counts[i] = data[i].size();
+            nvalues += counts[i];
+        }
+        values.reserve(nvalues);
+        for (auto &d:data) values.insert(values.end(), d.begin(), d.end());
+        write_ragged_dataset(name, data.size(), counts.data(), values.data(),
+            filetype_id, flag_parallel, flag_collective);
+    }
+    /// read the list of element index of a ragged array, a single hyperslab
+    /// read of the values once the bounding offsets are known
+    template <typename T> std::vector<T> read_ragged_element(H5PathView name, hsize_t index)
+    {
+        unsigned long long range[2];
+        read_from_dataset_nd(name+"/offsets", range,
+            std::vector<hsize_t>(1,2), std::vector<hsize_t>(1,index));
+        std::vector<T> val(range[1]-range[0]);
+        if (val.size() > 0) {
+            read_from_dataset_nd(name+"/values", val.data(),
+                std::vector<hsize_t>(1,val.size()), std::vector<hsize_t>(1,range[0]));
+        }
+        return val;
+    }
+
     /// get a dataset with full path given by name
     void get_dataset(std::vector<hid_t> &ids, const std::string &name);
     /// check if dataset exits
-    bool exists_dataset(const std::string &parent, const std::string &name);
+    bool exists_dataset(H5PathView parent, H5PathView name);
 
     /// get an attribute with full path given by name
     void get_attribute(std::vector<hid_t> &ids, const std::string &name);
 
     /// read scalar attribute
-    template<typename T> const T read_attribute(const std::string &name)
+    template<typename T> const T read_attribute(H5PathView name)
     {
-        std::string attr_name;
         T val;
-        hid_t type;
-        H5O_info_t object_info;
-        std::vector <hid_t> ids;
-        //traverse the file to get to the attribute, storing the ids of the
-        //groups, data spaces, etc that have been opened.
-        get_attribute(ids, name);
-        //now reverse ids and load attribute
-        reverse(ids.begin(),ids.end());
-        //determine hdf5 type of the array in memory
-        type = hdf5_type(T{});
+        hid_t attr_id = _open_attribute(name);
         // read the data
-        _do_read<T>(ids[0], type, val);
-        H5Aclose(ids[0]);
-        ids.erase(ids.begin());
-        //now have hdf5 ids traversed to get to desired attribute so move along to close all
-        //based on their object type
-        close_hdf_ids(ids);
+        _do_read<T>(attr_id, hdf5_type(T{}), val);
+        H5Aclose(attr_id);
         return val;
     }
     /// read vector attribute
-    template<typename T> const std::vector<T> read_attribute_v(const std::string &name)
+    template<typename T> const std::vector<T> read_attribute_v(H5PathView name)
     {
-        std::string attr_name;
         std::vector<T> val;
-        hid_t type;
-        H5O_info_t object_info;
-        std::vector <hid_t> ids;
-        //traverse the file to get to the attribute, storing the ids of the
-        //groups, data spaces, etc that have been opened.
-        get_attribute(ids, name);
-        //now reverse ids and load attribute
-        reverse(ids.begin(),ids.end());
-        //determine hdf5 type of the array in memory
-        type = hdf5_type(T{});
+        hid_t attr_id = _open_attribute(name);
         // read the data
-        _do_read_v<T>(ids[0], type, val);
-        H5Aclose(ids[0]);
-        ids.erase(ids.begin());
-        //now have hdf5 ids traversed to get to desired attribute so move along to close all
-        //based on their object type
-        close_hdf_ids(ids);
+        _do_read_v<T>(attr_id, hdf5_type(T{}), val);
+        H5Aclose(attr_id);
         return val;
     }
 
@@ -646,14 +1799,14 @@ public:
     bool exists_attribute(const std::string &parent, const std::string &name);
 
     /// write an attribute, not that since these are template function, define here in the header
-    template <typename T> void write_attribute(const std::string &parent, const std::string &name, const std::vector<T> &data)
+    template <typename T> void write_attribute(H5PathView parent, H5PathView name, const std::vector<T> &data)
     {
         // Get HDF5 data type of the value to write
         hid_t dtype_id = hdf5_type(data[0]);
         hsize_t size = data.size();
 
         // Open the parent object
-        hid_t parent_id = H5Oopen(file_id, parent.c_str(), H5P_DEFAULT);
+        hid_t parent_id = H5Oopen(file_id, H5PathBuffer(parent).c_str(), H5P_DEFAULT);
         if(parent_id < 0)io_error(std::string("Unable to open object to write attribute: ")+name);
 
         // Create dataspace
@@ -661,7 +1814,7 @@ public:
         hid_t dspace_extent  = H5Sset_extent_simple(dspace_id, 1, &size, NULL);
 
         // Create attribute
-        hid_t attr_id = H5Acreate(parent_id, name.c_str(), dtype_id, dspace_id, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t attr_id = H5Acreate(parent_id, H5PathBuffer(name).c_str(), dtype_id, dspace_id, H5P_DEFAULT, H5P_DEFAULT);
         if(attr_id < 0)io_error(std::string("Unable to create attribute ")+name+std::string(" on object ")+parent);
 
         // Write the attribute
@@ -674,20 +1827,20 @@ public:
         H5Oclose(parent_id);
     }
 
-    template <typename T> void write_attribute(const std::string &parent, const std::string &name, const T &data)
+    template <typename T> void write_attribute(H5PathView parent, H5PathView name, const T &data)
     {
         // Get HDF5 data type of the value to write
         hid_t dtype_id = hdf5_type(data);
 
         // Open the parent object
-        hid_t parent_id = H5Oopen(file_id, parent.c_str(), H5P_DEFAULT);
+        hid_t parent_id = H5Oopen(file_id, H5PathBuffer(parent).c_str(), H5P_DEFAULT);
         if(parent_id < 0)io_error(std::string("Unable to open object to write attribute: ")+name);
 
         // Create dataspace
         hid_t dspace_id = H5Screate(H5S_SCALAR);
 
         // Create attribute
-        hid_t attr_id = H5Acreate(parent_id, name.c_str(), dtype_id, dspace_id, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t attr_id = H5Acreate(parent_id, H5PathBuffer(name).c_str(), dtype_id, dspace_id, H5P_DEFAULT, H5P_DEFAULT);
         if(attr_id < 0)io_error(std::string("Unable to create attribute ")+name+std::string(" on object ")+parent);
 
         // Write the attribute
@@ -700,7 +1853,7 @@ public:
         H5Oclose(parent_id);
     }
 
-    void write_attribute(const std::string parent, const std::string &name, std::string data)
+    void write_attribute(H5PathView parent, H5PathView name, std::string data)
     {
         // Get HDF5 data type of the value to write
         hid_t dtype_id = H5Tcopy(H5T_C_S1);
@@ -709,14 +1862,14 @@ public:
         H5Tset_strpad(dtype_id, H5T_STR_NULLTERM);
 
         // Open the parent object
-        hid_t parent_id = H5Oopen(file_id, parent.c_str(), H5P_DEFAULT);
+        hid_t parent_id = H5Oopen(file_id, H5PathBuffer(parent).c_str(), H5P_DEFAULT);
         if(parent_id < 0)io_error(std::string("Unable to open object to write attribute: ")+name);
 
         // Create dataspace
         hid_t dspace_id = H5Screate(H5S_SCALAR);
 
         // Create attribute
-        hid_t attr_id = H5Acreate(parent_id, name.c_str(), dtype_id, dspace_id, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t attr_id = H5Acreate(parent_id, H5PathBuffer(name).c_str(), dtype_id, dspace_id, H5P_DEFAULT, H5P_DEFAULT);
         if(attr_id < 0)io_error(std::string("Unable to create attribute ")+name+std::string(" on object ")+parent);
 
         // Write the attribute
@@ -731,4 +1884,194 @@ public:
 
 };
 
+/// Pool of worker processes writing datasets to files of their own so that
+/// compression and I/O use several cores despite the global lock of HDF5.
+/// The workers are forked when the pool is built, and datasets handed to the
+/// pool are copied into shared memory slots of the least busy worker and
+/// written by it while the caller carries on (POSIX systems only). On close the workers finish
+/// their files (filename with .workerN before the extension) and filename is
+/// created with an external link to every dataset so it reads as one file.
+/// Datasets only, attributes are added to the combined file once closed.
+class H5WriterPool
+{
+public:
+    H5WriterPool(const std::string &filename, int nworkers,
+        size_t slot_bytes = 16*1024*1024, int nslots = 4);
+    ~H5WriterPool();
+
+    /// hand a dataset to a worker, returning once the data has been copied
+    void write_dataset_nd(H5PathView name, int rank, const hsize_t *dims,
+        const void *data, hid_t memtype_id, hid_t filetype_id = -1);
+    template <typename T> void write_dataset_nd(H5PathView name, H5Dims dims,
+        const T *data, hid_t filetype_id = -1)
+    {
+        write_dataset_nd(name, dims.size(), dims.data(), data, hdf5_type(T{}), filetype_id);
+    }
+    template <typename T> void write_dataset(H5PathView name, hsize_t len,
+        const T *data, hid_t filetype_id = -1)
+    {
+        write_dataset_nd(name, 1, &len, data, hdf5_type(T{}), filetype_id);
+    }
+    /// wait for the workers to finish and write the combined file, throwing if
+    /// a worker failed. The destructor closes a pool left open but only reports
+    /// failures to std::cerr.
+    void close();
+    /// file written by a worker
+    std::string worker_filename(int iworker) const;
+
+private:
+    struct Worker
+    {
+        pid_t pid;
+        /// socket carrying commands to the worker and acknowledgements back
+        int fd;
+        char *shm;
+        std::vector<bool> slot_free;
+        int nfree;
+        /// sizes of the datasets handed to the worker and not written yet
+        std::list<size_t> pending;
+        size_t pending_bytes;
+    };
+    std::string filename;
+    size_t slot_bytes;
+    int nslots;
+    std::vector<Worker> workers;
+    /// datasets and the worker that wrote them
+    std::vector<std::pair<std::string, int>> datasets;
+    /// worker the search for the least busy starts at, so ties are spread
+    int next_worker;
+    bool iopen;
+
+    /// handle one acknowledgement of the worker, waiting for it if iwait
+    bool _read_ack(Worker &worker, bool iwait);
+    int _acquire_slot(Worker &worker);
+    void _run_worker(int iworker, int fd, char *shm);
+
+    H5WriterPool(const H5WriterPool &);
+    H5WriterPool &operator=(const H5WriterPool &);
+};
+
+/// Conditions on the entries of an H5Catalog, all of which must hold
+class H5CatalogQuery
+{
+public:
+    /// numeric attribute in [lo,hi]
+    H5CatalogQuery &where(const std::string &attribute, double lo, double hi)
+    {
+        Condition condition = {attribute, lo, hi, std::string(), false, 0};
+        conditions.push_back(condition);
+        return *this;
+    }
+    /// string attribute equal to text
+    H5CatalogQuery &where(const std::string &attribute, const std::string &text)
+    {
+        Condition condition = {attribute, 0, 0, text, true, 0};
+        conditions.push_back(condition);
+        return *this;
+    }
+    /// dataset present with at least min_rows rows along its first dimension
+    H5CatalogQuery &with_dataset(const std::string &dataset, hsize_t min_rows = 0)
+    {
+        Condition condition = {dataset, 0, 0, std::string(), false, min_rows};
+        dataset_conditions.push_back(condition);
+        return *this;
+    }
+
+private:
+    friend class H5Catalog;
+    struct Condition
+    {
+        std::string name;
+        double lo, hi;
+        std::string text;
+        bool itext;
+        hsize_t min_rows;
+    };
+    std::vector<Condition> conditions, dataset_conditions;
+};
+
+/// Index of chosen attributes and dataset shapes of the HDF5 files in a
+/// directory so that the files matching a query are found without opening
+/// them. build() scans the files with several worker processes (POSIX systems
+/// only) and writes the index as one small HDF5 file, reusing the entries of
+/// an existing index built with the same attributes and datasets for files
+/// whose size and modification time have not changed. Attributes are named
+/// by the path of their object and their name, e.g. Header/Redshift.
+class H5Catalog
+{
+public:
+    /// attribute of a file, numeric attributes (the first element of arrays)
+    /// are held as value and strings as text
+    struct Attribute
+    {
+        enum Kind {ABSENT = 0, NUMERIC = 1, TEXT = 2};
+        int kind = ABSENT;
+        double value = 0;
+        std::string text;
+    };
+    /// a file, its catalogued attributes and the dimensions of its
+    /// catalogued datasets (rank -1 if absent), in the order given to build()
+    struct Entry
+    {
+        std::string filename;
+        unsigned long long size = 0;
+        long long mtime = 0;
+        std::vector<Attribute> attributes;
+        std::vector<int> ranks;
+        std::vector<std::vector<hsize_t>> dims;
+    };
+
+    /// Scan the files of directory with one of the extensions using nworkers
+    /// processes (by default the number of cores) and write the index
+    static void build(const std::string &directory, const std::string &index_filename,
+        const std::vector<std::string> &attributes, const std::vector<std::string> &datasets,
+        int nworkers = 0, const std::vector<std::string> &extensions = {".hdf5", ".h5"},
+        bool flag_update = true);
+
+    /// load an index
+    void open(const std::string &index_filename);
+
+    size_t size() const
+    {
+        return entries.size();
+    }
+    const Entry &entry(size_t i) const
+    {
+        return entries[i];
+    }
+    const std::vector<std::string> &attribute_names() const
+    {
+        return attributes;
+    }
+    const std::vector<std::string> &dataset_names() const
+    {
+        return datasets;
+    }
+    /// path of the file of an entry
+    std::string path(size_t i) const
+    {
+        return directory + "/" + entries[i].filename;
+    }
+    /// attribute of an entry, throws std::invalid_argument if not catalogued
+    const Attribute &attribute(size_t i, const std::string &name) const;
+    /// indices of the entries matching a query, throws std::invalid_argument
+    /// if it names attributes or datasets that are not catalogued
+    std::vector<size_t> find(const H5CatalogQuery &query) const;
+    /// paths of the files matching a query
+    std::vector<std::string> find_files(const H5CatalogQuery &query) const;
+
+private:
+    std::string directory;
+    std::vector<std::string> attributes, datasets;
+    std::vector<Entry> entries;
+
+    static long _find_name(const std::vector<std::string> &names, const std::string &name);
+};
+
+/// reading a string attribute needs the length of the string in the file
+template<> inline void H5OutputFile::_do_read<std::string>(const hid_t &attr, const hid_t &type, std::string &val)
+{
+    _do_read_string(attr, type, val);
+}
+
 #endif
@@ -0,0 +1,179 @@
+#include "HDF5Wrapper.h"
+#include <cmath>
+
+// Adaptive compression. Deflating chunks of noise costs time and gains
+// nothing, so the entropy of a sample of every chunk is estimated first.
+// Chunks expected to compress go through the filter pipeline as usual in one
+// write, the others are written as they are with H5Dwrite_chunk and the bits
+// of their filters set in the filter mask, which readers honour, so the file
+// stays readable by any HDF5 reader.
+
+/// bytes of each chunk sampled to estimate its entropy
+static const size_t ADAPTIVESAMPLEBYTES = 16384;
+/// number of evenly spaced blocks the sample is taken from
+static const size_t ADAPTIVESAMPLEBLOCKS = 16;
+
+/// copy the part of the data in a chunk into a chunk sized buffer, zero
+/// padding chunks at the edge of the dataset as stored by HDF5
+static void _copy_chunk(const void *data, size_t elsize, int rank, const hsize_t *dims,
+    const hsize_t *chunks, const hsize_t *start, const hsize_t *count, char *out)
+{
+    std::vector<size_t> strides(rank), chunk_strides(rank);
+    strides[rank-1] = chunk_strides[rank-1] = elsize;
+    for (auto i=rank-2;i>=0;i--) {
+        strides[i] = strides[i+1] * dims[i+1];
+        chunk_strides[i] = chunk_strides[i+1] * chunks[i+1];
+    }
+    bool ipartial = false;
+    for (auto i=0;i<rank;i++) if (count[i] != chunks[i]) ipartial = true;
+    if (ipartial) std::memset(out, 0, chunk_strides[0] * chunks[0]);
+
+    std::vector<hsize_t> idx(rank, 0);
+    size_t rowlen = count[rank-1] * elsize;
+    // walk the rows of the chunk, the last dimension being contiguous in memory
+    while (true) {
+        size_t offset = 0, chunk_offset = 0;
+        for (auto i=0;i<rank;i++) {
+            offset += (start[i] + idx[i]) * strides[i];
+            chunk_offset += idx[i] * chunk_strides[i];
+        }
+        std::memcpy(out + chunk_offset, (const char *)data + offset, rowlen);
+        int d = rank - 2;
+        while (d >= 0 && ++idx[d] == count[d]) {
+            idx[d] = 0;
+            d--;
+        }
+        if (d < 0) break;
+    }
+}
+
+/// estimate the compressed size of a chunk relative to its size from the
+/// order-0 entropy of a sample, of each byte of the elements separately if
+/// shuffled as that is how deflate will see them
+static double _estimate_ratio(const char *chunk, size_t nbytes, size_t elsize, bool shuffle)
+{
+    size_t nplanes = shuffle ? elsize : 1;
+    size_t nelem = nbytes / elsize;
+    size_t block_elem = std::max<size_t>(ADAPTIVESAMPLEBYTES / ADAPTIVESAMPLEBLOCKS / elsize, 1);
+    size_t nblocks = std::min(ADAPTIVESAMPLEBLOCKS, std::max<size_t>(nelem / block_elem, 1));
+    std::vector<unsigned int> hist(256 * nplanes, 0);
+    size_t nsampled = 0;
+    for (auto iblock=0;iblock<nblocks;iblock++) {
+        size_t first = (nelem / nblocks) * iblock;
+        size_t n = std::min(block_elem, nelem - first);
+        const unsigned char *p = (const unsigned char *)chunk + first * elsize;
+        for (auto i=0;i<n*elsize;i++) hist[256 * ((i % elsize) % nplanes) + p[i]]++;
+        nsampled += n;
+    }
+    if (nsampled == 0) return 0;
+
+    // Miller-Madow corrected entropy, in bits per byte, averaged over the planes
+    double bits = 0;
+    for (auto iplane=0;iplane<nplanes;iplane++) {
+        double nbytes_plane = (double)nsampled * elsize / nplanes, h = 0;
+        int nbins = 0;
+        for (auto i=0;i<256;i++) {
+            unsigned int c = hist[256 * iplane + i];
+            if (c == 0) continue;
+            double p = c / nbytes_plane;
+            h -= p * std::log2(p);
+            nbins++;
+        }
+        h += (nbins - 1) / (2.0 * nbytes_plane * std::log(2.0));
+        bits += std::min(h, 8.0);
+    }
+    return bits / nplanes / 8.0;
+}
+
+hsize_t H5OutputFile::write_dataset_adaptive(H5PathView name, int rank, hsize_t *dims,
+    const void *data, hid_t memtype_id, hid_t filetype_id,
+    int deflate_level, bool shuffle, double max_ratio, hsize_t chunk_rows)
+{
+    if (file_id < 0) return 0;
+    if (memtype_id == -1) {
+        throw std::runtime_error("Adaptive write called with no type info passed.");
+    }
+    if (filetype_id < 0) filetype_id = memtype_id;
+#ifdef USEPARALLELHDF
+    // chunks cannot be written directly through the MPI-IO driver
+    hid_t fapl_id = H5Fget_access_plist(file_id);
+    bool impio = (H5Pget_driver(fapl_id) == H5FD_MPIO);
+    H5Pclose(fapl_id);
+    if (impio) io_error(std::string("Adaptive writes need a file opened by a single task: ")+name);
+#endif
+    std::vector<hsize_t> chunks(dims, dims + rank), nchunks_dim(rank), start(rank), count(rank);
+    hsize_t nchunks = 1;
+    bool nonzero_size = true;
+    chunks[0] = std::min<hsize_t>((chunk_rows > 0) ? chunk_rows : HDFOUTPUTCHUNKSIZE, dims[0]);
+    for (auto i=0;i<rank;i++) {
+        if (dims[i] == 0) nonzero_size = false;
+        chunks[i] = std::max<hsize_t>(chunks[i], 1);
+        nchunks_dim[i] = (dims[i] + chunks[i] - 1) / chunks[i];
+        nchunks *= nchunks_dim[i];
+    }
+
+    hid_t dcpl_id = H5P_DEFAULT;
+    if (nonzero_size) {
+        dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
+        H5Pset_chunk(dcpl_id, rank, chunks.data());
+        if (shuffle) H5Pset_shuffle(dcpl_id);
+        H5Pset_deflate(dcpl_id, deflate_level);
+    }
+    hid_t dspace_id = H5Screate_simple(rank, dims, NULL);
+    _create_parent_groups(name);
+    hid_t dset_id = H5Dcreate(file_id, H5PathBuffer(name).c_str(), filetype_id, dspace_id,
+        H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+    if (dcpl_id != H5P_DEFAULT) H5Pclose(dcpl_id);
+    if (dset_id < 0) io_error(std::string("Failed to create dataset: ")+name);
+    if (!nonzero_size) {
+        H5Sclose(dspace_id);
+        H5Dclose(dset_id);
+        return 0;
+    }
+
+    // every filter of the pipeline skipped
+    uint32_t raw_mask = shuffle ? 0x3 : 0x1;
+    size_t elsize = H5Tget_size(memtype_id), file_elsize = H5Tget_size(filetype_id);
+    bool iconvert = (H5Tequal(memtype_id, filetype_id) <= 0);
+    hsize_t chunk_npoints = 1;
+    for (auto &c:chunks) chunk_npoints *= c;
+    H5StagingBuffer buf = staging_pool.acquire(chunk_npoints * std::max(elsize, file_elsize));
+    char *chunk = (char *)buf.data();
+
+    hid_t memspace_id = H5Screate_simple(rank, dims, NULL);
+    H5Sselect_none(dspace_id);
+    H5Sselect_none(memspace_id);
+    hsize_t nraw = 0, ncompressed = 0;
+    for (hsize_t ichunk=0; ichunk<nchunks; ichunk++) {
+        hsize_t index = ichunk;
+        for (auto i=rank-1;i>=0;i--) {
+            start[i] = (index % nchunks_dim[i]) * chunks[i];
+            count[i] = std::min(chunks[i], dims[i] - start[i]);
+            index /= nchunks_dim[i];
+        }
+        _copy_chunk(data, elsize, rank, dims, chunks.data(), start.data(), count.data(), chunk);
+        if (iconvert) H5Tconvert(memtype_id, filetype_id, chunk_npoints, chunk, NULL, H5P_DEFAULT);
+        if (_estimate_ratio(chunk, chunk_npoints * file_elsize, file_elsize, shuffle) >= max_ratio) {
+            if (H5Dwrite_chunk(dset_id, H5P_DEFAULT, raw_mask, start.data(), chunk_npoints * file_elsize, chunk) < 0)
+                io_error(std::string("Failed to write raw chunk of dataset: ")+name);
+            nraw++;
+        }
+        else {
+            H5Sselect_hyperslab(dspace_id, H5S_SELECT_OR, start.data(), NULL, count.data(), NULL);
+            H5Sselect_hyperslab(memspace_id, H5S_SELECT_OR, start.data(), NULL, count.data(), NULL);
+            ncompressed++;
+        }
+    }
+    buf.release();
+    // the compressible chunks are written together through the filter pipeline
+    if (ncompressed > 0) {
+        if (H5Dwrite(dset_id, memtype_id, memspace_id, dspace_id, H5P_DEFAULT, data) < 0)
+            io_error(std::string("Failed to write dataset: ")+name);
+    }
+    H5Sclose(memspace_id);
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+
+    if (write_statistics) _write_statistics(name, data, memtype_id, rank, dims, false, false);
+    return nraw;
+}
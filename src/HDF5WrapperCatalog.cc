@@ -0,0 +1,624 @@
+#include "HDF5Wrapper.h"
+#include <atomic>
+#include <new>
+#include <limits>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// Catalog of a directory of HDF5 files. Worker processes take the files in
+// turn through a counter in shared memory, read the chosen attributes and
+// the shapes of the chosen datasets and send each entry back through a pipe
+// as a length prefixed record. The index holds one row per file:
+//
+//   /files/name, /files/size, /files/mtime    file name, size and mtime (ns)
+//   /attribute_names                          catalogued attributes
+//   /attribute_kinds [nfiles][nattr]          absent, numeric or text
+//   /attribute_values [nfiles][nattr]         numeric value, NaN otherwise
+//   /attribute_strings [nfiles][nattr]        text value
+//   /dataset_names                            catalogued datasets
+//   /dataset_ranks [nfiles][ndset]            rank, -1 if absent
+//   /dataset_dims [nfiles][ndset][maxrank]    dimensions
+//
+// with the directory and the format version as attributes of the root group.
+
+static const int CATALOGVERSION = 1;
+
+/// records appended to and parsed from a byte buffer
+static void _put_bytes(std::vector<char> &buf, const void *p, size_t n)
+{
+    buf.insert(buf.end(), (const char *)p, (const char *)p + n);
+}
+template<typename T> static void _put_value(std::vector<char> &buf, T v)
+{
+    _put_bytes(buf, &v, sizeof(T));
+}
+static void _put_string(std::vector<char> &buf, const std::string &s)
+{
+    _put_value<uint64_t>(buf, s.size());
+    _put_bytes(buf, s.data(), s.size());
+}
+template<typename T> static T _get_value(const char *&p)
+{
+    T v;
+    std::memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return v;
+}
+static std::string _get_string(const char *&p)
+{
+    uint64_t n = _get_value<uint64_t>(p);
+    std::string s(p, n);
+    p += n;
+    return s;
+}
+
+static void _encode_entry(const H5Catalog::Entry &entry, std::vector<char> &buf)
+{
+    _put_string(buf, entry.filename);
+    _put_value(buf, entry.size);
+    _put_value(buf, entry.mtime);
+    for (auto &attribute:entry.attributes) {
+        _put_value(buf, attribute.kind);
+        _put_value(buf, attribute.value);
+        _put_string(buf, attribute.text);
+    }
+    for (auto i=0;i<entry.ranks.size();i++) {
+        _put_value(buf, entry.ranks[i]);
+        for (auto &dim:entry.dims[i]) _put_value(buf, dim);
+    }
+}
+
+static void _decode_entry(const char *p, size_t nattr, size_t ndset, H5Catalog::Entry &entry)
+{
+    entry.filename = _get_string(p);
+    entry.size = _get_value<unsigned long long>(p);
+    entry.mtime = _get_value<long long>(p);
+    entry.attributes.resize(nattr);
+    for (auto &attribute:entry.attributes) {
+        attribute.kind = _get_value<int>(p);
+        attribute.value = _get_value<double>(p);
+        attribute.text = _get_string(p);
+    }
+    entry.ranks.resize(ndset);
+    entry.dims.resize(ndset);
+    for (auto i=0;i<ndset;i++) {
+        entry.ranks[i] = _get_value<int>(p);
+        entry.dims[i].resize(std::max(entry.ranks[i], 0));
+        for (auto &dim:entry.dims[i]) dim = _get_value<hsize_t>(p);
+    }
+}
+
+/// true if every link along path exists, H5Lexists failing on missing parents
+static bool _exists_link_path(hid_t file_id, const std::string &path)
+{
+    if (path.empty() || path == "/") return true;
+    size_t pos = (path[0] == '/') ? 1 : 0;
+    while (true) {
+        size_t next = path.find('/', pos);
+        std::string partial = path.substr(0, next);
+        if (H5Lexists(file_id, partial.c_str(), H5P_DEFAULT) <= 0) return false;
+        if (next == std::string::npos || next + 1 == path.size()) return true;
+        pos = next + 1;
+    }
+}
+
+/// read the first element of an attribute named by the path of its object and its name
+static void _read_catalog_attribute(hid_t file_id, const std::string &path, H5Catalog::Attribute &attribute)
+{
+    size_t pos = path.rfind('/');
+    std::string object = (pos == std::string::npos || pos == 0) ? "/" : path.substr(0, pos);
+    std::string name = (pos == std::string::npos) ? path : path.substr(pos + 1);
+    if (!_exists_link_path(file_id, object)) return;
+    if (H5Aexists_by_name(file_id, object.c_str(), name.c_str(), H5P_DEFAULT) <= 0) return;
+    hid_t attr_id = H5Aopen_by_name(file_id, object.c_str(), name.c_str(), H5P_DEFAULT, H5P_DEFAULT);
+    if (attr_id < 0) return;
+    hid_t type_id = H5Aget_type(attr_id);
+    hid_t space_id = H5Aget_space(attr_id);
+    hssize_t npoints = H5Sget_simple_extent_npoints(space_id);
+    H5T_class_t type_class = H5Tget_class(type_id);
+    if (npoints > 0 && type_class == H5T_STRING) {
+        if (H5Tis_variable_str(type_id) > 0) {
+            std::vector<char *> values(npoints, (char *)NULL);
+            hid_t memtype_id = H5Tcopy(H5T_C_S1);
+            H5Tset_size(memtype_id, H5T_VARIABLE);
+            if (H5Aread(attr_id, memtype_id, values.data()) >= 0) {
+                attribute.kind = H5Catalog::Attribute::TEXT;
+                if (values[0] != NULL) attribute.text = values[0];
+                for (auto &value:values) if (value != NULL) H5free_memory(value);
+            }
+            H5Tclose(memtype_id);
+        }
+        else {
+            size_t size = H5Tget_size(type_id);
+            std::vector<char> values(npoints * size);
+            hid_t memtype_id = H5Tcopy(type_id);
+            if (H5Aread(attr_id, memtype_id, values.data()) >= 0) {
+                attribute.kind = H5Catalog::Attribute::TEXT;
+                attribute.text.assign(values.data(), strnlen(values.data(), size));
+            }
+            H5Tclose(memtype_id);
+        }
+    }
+    else if (npoints > 0 && (type_class == H5T_INTEGER || type_class == H5T_FLOAT)) {
+        std::vector<double> values(npoints);
+        if (H5Aread(attr_id, H5T_NATIVE_DOUBLE, values.data()) >= 0) {
+            attribute.kind = H5Catalog::Attribute::NUMERIC;
+            attribute.value = values[0];
+        }
+    }
+    H5Sclose(space_id);
+    H5Tclose(type_id);
+    H5Aclose(attr_id);
+}
+
+/// fill the attributes and dataset shapes of an entry, false if not an HDF5 file
+static bool _scan_file(const std::string &path, const std::vector<std::string> &attributes,
+    const std::vector<std::string> &datasets, H5Catalog::Entry &entry)
+{
+    entry.attributes.assign(attributes.size(), H5Catalog::Attribute());
+    entry.ranks.assign(datasets.size(), -1);
+    entry.dims.assign(datasets.size(), std::vector<hsize_t>());
+    if (H5Fis_hdf5(path.c_str()) <= 0) return false;
+    hid_t file_id = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id < 0) return false;
+    for (auto i=0;i<attributes.size();i++) _read_catalog_attribute(file_id, attributes[i], entry.attributes[i]);
+    for (auto i=0;i<datasets.size();i++) {
+        if (!_exists_link_path(file_id, datasets[i])) continue;
+        hid_t dset_id = H5Dopen(file_id, datasets[i].c_str(), H5P_DEFAULT);
+        if (dset_id < 0) continue;
+        hid_t space_id = H5Dget_space(dset_id);
+        int rank = H5Sget_simple_extent_ndims(space_id);
+        if (rank >= 0) {
+            entry.ranks[i] = rank;
+            entry.dims[i].resize(rank);
+            H5Sget_simple_extent_dims(space_id, entry.dims[i].data(), NULL);
+        }
+        H5Sclose(space_id);
+        H5Dclose(dset_id);
+    }
+    H5Fclose(file_id);
+    return true;
+}
+
+/// write a dataset of fixed length strings
+static void _write_catalog_strings(hid_t file_id, const std::string &name,
+    const std::vector<std::string> &values, int rank, const hsize_t *dims)
+{
+    size_t size = 1;
+    for (auto &value:values) size = std::max(size, value.size());
+    std::vector<char> buf(values.size() * size, 0);
+    for (auto i=0;i<values.size();i++) std::memcpy(&buf[i * size], values[i].data(), values[i].size());
+    hid_t type_id = H5Tcopy(H5T_C_S1);
+    H5Tset_size(type_id, size);
+    H5Tset_strpad(type_id, H5T_STR_NULLPAD);
+    hid_t space_id = H5Screate_simple(rank, dims, NULL);
+    hid_t dset_id = H5Dcreate(file_id, name.c_str(), type_id, space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    herr_t ret = (dset_id < 0) ? -1 : H5Dwrite(dset_id, type_id, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf.data());
+    if (dset_id >= 0) H5Dclose(dset_id);
+    H5Sclose(space_id);
+    H5Tclose(type_id);
+    if (ret < 0) throw std::runtime_error("Failed to write catalog dataset: " + name);
+}
+
+static void _write_catalog_array(hid_t file_id, const std::string &name, hid_t type_id,
+    int rank, const hsize_t *dims, const void *data)
+{
+    hid_t space_id = H5Screate_simple(rank, dims, NULL);
+    hid_t dset_id = H5Dcreate(file_id, name.c_str(), type_id, space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    herr_t ret = (dset_id < 0) ? -1 : H5Dwrite(dset_id, type_id, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+    if (dset_id >= 0) H5Dclose(dset_id);
+    H5Sclose(space_id);
+    if (ret < 0) throw std::runtime_error("Failed to write catalog dataset: " + name);
+}
+
+static std::vector<std::string> _read_catalog_strings(hid_t file_id, const std::string &name)
+{
+    hid_t dset_id = H5Dopen(file_id, name.c_str(), H5P_DEFAULT);
+    if (dset_id < 0) throw std::runtime_error("Catalog index lacks dataset: " + name);
+    hid_t type_id = H5Dget_type(dset_id);
+    hid_t space_id = H5Dget_space(dset_id);
+    size_t size = H5Tget_size(type_id);
+    hssize_t npoints = H5Sget_simple_extent_npoints(space_id);
+    std::vector<char> buf(npoints * size + 1);
+    herr_t ret = (npoints > 0) ? H5Dread(dset_id, type_id, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf.data()) : 0;
+    H5Sclose(space_id);
+    H5Tclose(type_id);
+    H5Dclose(dset_id);
+    if (ret < 0) throw std::runtime_error("Failed to read catalog dataset: " + name);
+    std::vector<std::string> values(npoints);
+    for (auto i=0;i<npoints;i++) values[i].assign(&buf[i * size], strnlen(&buf[i * size], size));
+    return values;
+}
+
+template<typename T> static std::vector<T> _read_catalog_array(hid_t file_id,
+    const std::string &name, hid_t memtype_id)
+{
+    hid_t dset_id = H5Dopen(file_id, name.c_str(), H5P_DEFAULT);
+    if (dset_id < 0) throw std::runtime_error("Catalog index lacks dataset: " + name);
+    hid_t space_id = H5Dget_space(dset_id);
+    std::vector<T> values(H5Sget_simple_extent_npoints(space_id));
+    herr_t ret = (values.size() > 0) ? H5Dread(dset_id, memtype_id, H5S_ALL, H5S_ALL, H5P_DEFAULT, values.data()) : 0;
+    H5Sclose(space_id);
+    H5Dclose(dset_id);
+    if (ret < 0) throw std::runtime_error("Failed to read catalog dataset: " + name);
+    return values;
+}
+
+static void _write_catalog(const std::string &index_filename, const std::string &directory,
+    const std::vector<std::string> &attributes, const std::vector<std::string> &datasets,
+    const std::vector<H5Catalog::Entry> &entries)
+{
+    // the index is replaced only once complete so readers never see a partial one
+    std::string tmpname = index_filename + ".tmp";
+    hid_t file_id = H5Fcreate(tmpname.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (file_id < 0) throw std::runtime_error("Failed to create catalog index: " + index_filename);
+    try {
+        hsize_t nfiles = entries.size(), nattr = attributes.size(), ndset = datasets.size();
+        hsize_t maxrank = 1;
+        for (auto &entry:entries) for (auto &rank:entry.ranks) maxrank = std::max<hsize_t>(maxrank, std::max(rank, 0));
+
+        hid_t group_id = H5Gcreate(file_id, "files", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        H5Gclose(group_id);
+        std::vector<std::string> names(nfiles), texts(nfiles * nattr);
+        std::vector<unsigned long long> sizes(nfiles);
+        std::vector<long long> mtimes(nfiles);
+        std::vector<int8_t> kinds(nfiles * nattr);
+        std::vector<double> values(nfiles * nattr);
+        std::vector<int> ranks(nfiles * ndset);
+        std::vector<hsize_t> dims(nfiles * ndset * maxrank, 0);
+        for (auto i=0;i<nfiles;i++) {
+            const H5Catalog::Entry &entry = entries[i];
+            names[i] = entry.filename;
+            sizes[i] = entry.size;
+            mtimes[i] = entry.mtime;
+            for (auto j=0;j<nattr;j++) {
+                kinds[i * nattr + j] = entry.attributes[j].kind;
+                values[i * nattr + j] = (entry.attributes[j].kind == H5Catalog::Attribute::NUMERIC) ?
+                    entry.attributes[j].value : std::numeric_limits<double>::quiet_NaN();
+                texts[i * nattr + j] = entry.attributes[j].text;
+            }
+            for (auto j=0;j<ndset;j++) {
+                ranks[i * ndset + j] = entry.ranks[j];
+                for (auto k=0;k<entry.dims[j].size();k++) dims[(i * ndset + j) * maxrank + k] = entry.dims[j][k];
+            }
+        }
+        hsize_t shape[3] = {nfiles, nattr, maxrank};
+        _write_catalog_strings(file_id, "files/name", names, 1, &nfiles);
+        _write_catalog_array(file_id, "files/size", H5T_NATIVE_ULLONG, 1, &nfiles, sizes.data());
+        _write_catalog_array(file_id, "files/mtime", H5T_NATIVE_LLONG, 1, &nfiles, mtimes.data());
+        _write_catalog_strings(file_id, "attribute_names", attributes, 1, &nattr);
+        _write_catalog_array(file_id, "attribute_kinds", H5T_NATIVE_INT8, 2, shape, kinds.data());
+        _write_catalog_array(file_id, "attribute_values", H5T_NATIVE_DOUBLE, 2, shape, values.data());
+        _write_catalog_strings(file_id, "attribute_strings", texts, 2, shape);
+        shape[1] = ndset;
+        _write_catalog_strings(file_id, "dataset_names", datasets, 1, &ndset);
+        _write_catalog_array(file_id, "dataset_ranks", H5T_NATIVE_INT, 2, shape, ranks.data());
+        _write_catalog_array(file_id, "dataset_dims", H5T_NATIVE_HSIZE, 3, shape, dims.data());
+
+        hid_t scalar_id = H5Screate(H5S_SCALAR);
+        hid_t attr_id = H5Acreate(file_id, "catalog_version", H5T_NATIVE_INT, scalar_id, H5P_DEFAULT, H5P_DEFAULT);
+        H5Awrite(attr_id, H5T_NATIVE_INT, &CATALOGVERSION);
+        H5Aclose(attr_id);
+        hid_t type_id = H5Tcopy(H5T_C_S1);
+        H5Tset_size(type_id, std::max<size_t>(directory.size(), 1));
+        H5Tset_strpad(type_id, H5T_STR_NULLPAD);
+        std::vector<char> buf(std::max<size_t>(directory.size(), 1), 0);
+        std::memcpy(buf.data(), directory.data(), directory.size());
+        attr_id = H5Acreate(file_id, "catalog_directory", type_id, scalar_id, H5P_DEFAULT, H5P_DEFAULT);
+        H5Awrite(attr_id, type_id, buf.data());
+        H5Aclose(attr_id);
+        H5Tclose(type_id);
+        H5Sclose(scalar_id);
+    }
+    catch (...) {
+        H5Fclose(file_id);
+        unlink(tmpname.c_str());
+        throw;
+    }
+    H5Fclose(file_id);
+    if (rename(tmpname.c_str(), index_filename.c_str()) != 0) {
+        unlink(tmpname.c_str());
+        throw std::runtime_error("Failed to replace catalog index: " + index_filename);
+    }
+}
+
+/// names of the files of directory with one of the extensions, sorted
+static std::vector<std::string> _list_catalog_files(const std::string &directory,
+    const std::vector<std::string> &extensions)
+{
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL) throw std::runtime_error("Failed to open catalog directory: " + directory);
+    std::vector<std::string> names;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        std::string name = ent->d_name;
+        for (auto &extension:extensions) {
+            if (name.size() > extension.size() &&
+                name.compare(name.size() - extension.size(), extension.size(), extension) == 0) {
+                names.push_back(name);
+                break;
+            }
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+/// true if path names the same file as the index, which is never catalogued
+static bool _same_file(const std::string &path, const struct stat &index_st, bool iindex)
+{
+    struct stat st;
+    return iindex && stat(path.c_str(), &st) == 0 && st.st_dev == index_st.st_dev && st.st_ino == index_st.st_ino;
+}
+
+void H5Catalog::build(const std::string &directory, const std::string &index_filename,
+    const std::vector<std::string> &attributes, const std::vector<std::string> &datasets,
+    int nworkers, const std::vector<std::string> &extensions, bool flag_update)
+{
+    struct stat index_st;
+    bool iindex = (stat(index_filename.c_str(), &index_st) == 0);
+
+    // entries of an earlier index with the same attributes and datasets
+    std::map<std::string, Entry> previous;
+    if (flag_update && iindex) {
+        H5Catalog old;
+        try {
+            old.open(index_filename);
+            if (old.attributes == attributes && old.datasets == datasets) {
+                for (auto &entry:old.entries) previous[entry.filename] = entry;
+            }
+        }
+        catch (std::runtime_error &) {
+        }
+    }
+
+    std::vector<Entry> entries;
+    std::vector<size_t> toscan;
+    for (auto &name:_list_catalog_files(directory, extensions)) {
+        std::string path = directory + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (_same_file(path, index_st, iindex)) continue;
+        Entry entry;
+        entry.filename = name;
+        entry.size = st.st_size;
+#if defined(__linux__)
+        entry.mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+        entry.mtime = (long long)st.st_mtime * 1000000000LL;
+#endif
+        auto it = previous.find(name);
+        if (it != previous.end() && it->second.size == entry.size && it->second.mtime == entry.mtime) {
+            entries.push_back(it->second);
+            continue;
+        }
+        toscan.push_back(entries.size());
+        entries.push_back(entry);
+    }
+
+    // the workers take the files in turn through a counter in shared memory
+    if (nworkers <= 0) nworkers = std::max<long>(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    nworkers = std::min<size_t>(nworkers, toscan.size());
+    std::atomic<long long> *next_file = NULL;
+    if (nworkers > 0) {
+        next_file = (std::atomic<long long> *)mmap(NULL, sizeof(std::atomic<long long>),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (next_file == MAP_FAILED) throw std::runtime_error("Failed to map shared memory of catalog");
+        new (next_file) std::atomic<long long>(0);
+    }
+    std::vector<pid_t> pids;
+    std::vector<int> fds;
+    for (auto iworker=0;iworker<nworkers;iworker++) {
+        int pipefd[2];
+        if (pipe(pipefd) != 0) throw std::runtime_error("Failed to create pipe of catalog");
+        pid_t pid = fork();
+        if (pid < 0) throw std::runtime_error("Failed to fork catalog worker");
+        if (pid == 0) {
+            ::close(pipefd[0]);
+            for (auto &fd:fds) ::close(fd);
+            // files that are not HDF5 or lack the attributes are expected, not errors
+            H5Eset_auto(H5E_DEFAULT, NULL, NULL);
+            long long ifile;
+            std::vector<char> buf;
+            while ((ifile = next_file->fetch_add(1)) < (long long)toscan.size()) {
+                Entry &entry = entries[toscan[ifile]];
+                bool ihdf = _scan_file(directory + "/" + entry.filename, attributes, datasets, entry);
+                buf.clear();
+                _put_value<uint64_t>(buf, 0);
+                _put_value(buf, ifile);
+                _put_value(buf, (char)ihdf);
+                _encode_entry(entry, buf);
+                uint64_t nbytes = buf.size() - sizeof(uint64_t);
+                std::memcpy(buf.data(), &nbytes, sizeof(nbytes));
+                const char *p = buf.data();
+                size_t left = buf.size();
+                while (left > 0) {
+                    ssize_t n = write(pipefd[1], p, left);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n <= 0) _exit(1);
+                    p += n;
+                    left -= n;
+                }
+            }
+            ::close(pipefd[1]);
+            _exit(0);
+        }
+        ::close(pipefd[1]);
+        pids.push_back(pid);
+        fds.push_back(pipefd[0]);
+    }
+
+    // the pipes are drained as the workers fill them, records parsed once complete
+    std::vector<std::vector<char>> streams(nworkers);
+    std::vector<struct pollfd> pfds(nworkers);
+    for (auto i=0;i<nworkers;i++) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+    }
+    int nopen = nworkers;
+    char chunk[65536];
+    while (nopen > 0) {
+        if (poll(pfds.data(), pfds.size(), -1) < 0) continue;
+        for (auto i=0;i<nworkers;i++) {
+            if (pfds[i].fd < 0 || pfds[i].revents == 0) continue;
+            ssize_t n = read(pfds[i].fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) continue;
+            if (n > 0) {
+                streams[i].insert(streams[i].end(), chunk, chunk + n);
+                continue;
+            }
+            ::close(pfds[i].fd);
+            pfds[i].fd = -1;
+            nopen--;
+        }
+    }
+    bool ifailed = false;
+    for (auto &pid:pids) {
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ifailed = true;
+    }
+    if (next_file != NULL) munmap(next_file, sizeof(std::atomic<long long>));
+
+    std::vector<bool> iscanned(toscan.size(), false), ihdf(entries.size(), true);
+    for (auto &stream:streams) {
+        const char *p = stream.data(), *end = stream.data() + stream.size();
+        while (end - p >= (ptrdiff_t)sizeof(uint64_t)) {
+            uint64_t nbytes = _get_value<uint64_t>(p);
+            if ((uint64_t)(end - p) < nbytes) break;
+            const char *record = p;
+            long long ifile = _get_value<long long>(record);
+            bool iscan_hdf = _get_value<char>(record);
+            _decode_entry(record, attributes.size(), datasets.size(), entries[toscan[ifile]]);
+            iscanned[ifile] = true;
+            ihdf[toscan[ifile]] = iscan_hdf;
+            p += nbytes;
+        }
+    }
+    if (ifailed || std::find(iscanned.begin(), iscanned.end(), false) != iscanned.end())
+        throw std::runtime_error("A catalog worker failed, the index is not written");
+
+    std::vector<Entry> catalogued;
+    for (auto i=0;i<entries.size();i++) if (ihdf[i]) catalogued.push_back(std::move(entries[i]));
+    _write_catalog(index_filename, directory, attributes, datasets, catalogued);
+}
+
+void H5Catalog::open(const std::string &index_filename)
+{
+    hid_t file_id = H5Fopen(index_filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id < 0) throw std::runtime_error("Failed to open catalog index: " + index_filename);
+    try {
+        int version = 0;
+        if (H5Aexists(file_id, "catalog_version") <= 0) throw std::runtime_error("Not a catalog index: " + index_filename);
+        hid_t attr_id = H5Aopen(file_id, "catalog_version", H5P_DEFAULT);
+        H5Aread(attr_id, H5T_NATIVE_INT, &version);
+        H5Aclose(attr_id);
+        if (version != CATALOGVERSION) throw std::runtime_error("Unsupported catalog index version: " + index_filename);
+        attr_id = H5Aopen(file_id, "catalog_directory", H5P_DEFAULT);
+        hid_t type_id = H5Aget_type(attr_id);
+        size_t size = H5Tget_size(type_id);
+        std::vector<char> buf(size + 1, 0);
+        H5Aread(attr_id, type_id, buf.data());
+        H5Tclose(type_id);
+        H5Aclose(attr_id);
+        directory.assign(buf.data(), strnlen(buf.data(), size));
+
+        attributes = _read_catalog_strings(file_id, "attribute_names");
+        datasets = _read_catalog_strings(file_id, "dataset_names");
+        std::vector<std::string> names = _read_catalog_strings(file_id, "files/name");
+        auto sizes = _read_catalog_array<unsigned long long>(file_id, "files/size", H5T_NATIVE_ULLONG);
+        auto mtimes = _read_catalog_array<long long>(file_id, "files/mtime", H5T_NATIVE_LLONG);
+        auto kinds = _read_catalog_array<int8_t>(file_id, "attribute_kinds", H5T_NATIVE_INT8);
+        auto values = _read_catalog_array<double>(file_id, "attribute_values", H5T_NATIVE_DOUBLE);
+        std::vector<std::string> texts = _read_catalog_strings(file_id, "attribute_strings");
+        auto ranks = _read_catalog_array<int>(file_id, "dataset_ranks", H5T_NATIVE_INT);
+        auto dims = _read_catalog_array<hsize_t>(file_id, "dataset_dims", H5T_NATIVE_HSIZE);
+        size_t nfiles = names.size(), nattr = attributes.size(), ndset = datasets.size();
+        size_t maxrank = (nfiles * ndset > 0) ? dims.size() / (nfiles * ndset) : 0;
+
+        entries.resize(nfiles);
+        for (auto i=0;i<nfiles;i++) {
+            Entry &entry = entries[i];
+            entry.filename = names[i];
+            entry.size = sizes[i];
+            entry.mtime = mtimes[i];
+            entry.attributes.resize(nattr);
+            for (auto j=0;j<nattr;j++) {
+                entry.attributes[j].kind = kinds[i * nattr + j];
+                entry.attributes[j].value = values[i * nattr + j];
+                entry.attributes[j].text = texts[i * nattr + j];
+            }
+            entry.ranks.resize(ndset);
+            entry.dims.resize(ndset);
+            for (auto j=0;j<ndset;j++) {
+                entry.ranks[j] = ranks[i * ndset + j];
+                auto first = dims.begin() + (i * ndset + j) * maxrank;
+                entry.dims[j].assign(first, first + std::max(entry.ranks[j], 0));
+            }
+        }
+    }
+    catch (...) {
+        H5Fclose(file_id);
+        throw;
+    }
+    H5Fclose(file_id);
+}
+
+long H5Catalog::_find_name(const std::vector<std::string> &names, const std::string &name)
+{
+    auto it = std::find(names.begin(), names.end(), name);
+    return (it == names.end()) ? -1 : it - names.begin();
+}
+
+const H5Catalog::Attribute &H5Catalog::attribute(size_t i, const std::string &name) const
+{
+    long iattr = _find_name(attributes, name);
+    if (iattr < 0) throw std::invalid_argument("Attribute not in catalog: " + name);
+    return entries[i].attributes[iattr];
+}
+
+std::vector<size_t> H5Catalog::find(const H5CatalogQuery &query) const
+{
+    std::vector<long> iattrs, idsets;
+    for (auto &condition:query.conditions) {
+        iattrs.push_back(_find_name(attributes, condition.name));
+        if (iattrs.back() < 0) throw std::invalid_argument("Attribute not in catalog: " + condition.name);
+    }
+    for (auto &condition:query.dataset_conditions) {
+        idsets.push_back(_find_name(datasets, condition.name));
+        if (idsets.back() < 0) throw std::invalid_argument("Dataset not in catalog: " + condition.name);
+    }
+    std::vector<size_t> matches;
+    for (auto i=0;i<entries.size();i++) {
+        const Entry &entry = entries[i];
+        bool imatch = true;
+        for (auto j=0;j<iattrs.size() && imatch;j++) {
+            const H5CatalogQuery::Condition &condition = query.conditions[j];
+            const Attribute &attribute = entry.attributes[iattrs[j]];
+            if (condition.itext) imatch = (attribute.kind == Attribute::TEXT && attribute.text == condition.text);
+            else imatch = (attribute.kind == Attribute::NUMERIC &&
+                attribute.value >= condition.lo && attribute.value <= condition.hi);
+        }
+        for (auto j=0;j<idsets.size() && imatch;j++) {
+            hsize_t min_rows = query.dataset_conditions[j].min_rows;
+            int rank = entry.ranks[idsets[j]];
+            imatch = (rank >= 0) && (min_rows == 0 || (rank > 0 && entry.dims[idsets[j]][0] >= min_rows));
+        }
+        if (imatch) matches.push_back(i);
+    }
+    return matches;
+}
+
+std::vector<std::string> H5Catalog::find_files(const H5CatalogQuery &query) const
+{
+    std::vector<std::string> files;
+    for (auto &i:find(query)) files.push_back(path(i));
+    return files;
+}
@@ -0,0 +1,292 @@
+#include "HDF5Wrapper.h"
+#include <fstream>
+#include <cstdio>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#endif
+
+// Incremental checkpoints. Datasets are stored chunked along with a
+// companion dataset holding a hash of every chunk. When a checkpoint is
+// rewritten only the chunks whose hash differs are written, the rest of
+// the file is left untouched.
+
+/// start and count of chunk ichunk, chunks ordered row major over the chunk grid
+static void _chunk_bounds(hsize_t ichunk, int rank, const hsize_t *dims,
+    const hsize_t *chunks, const hsize_t *nchunks_dim, hsize_t *start, hsize_t *count)
+{
+    for (auto i=rank-1;i>=0;i--) {
+        start[i] = (ichunk % nchunks_dim[i]) * chunks[i];
+        count[i] = std::min(chunks[i], dims[i] - start[i]);
+        ichunk /= nchunks_dim[i];
+    }
+}
+
+void H5OutputFile::_hash_chunks(std::vector<uint64_t> &hashes, const void *data, size_t elsize,
+    int rank, const hsize_t *dims, const hsize_t *chunks)
+{
+    std::vector<hsize_t> nchunks_dim(rank);
+    std::vector<size_t> strides(rank);
+    long long nchunks = 1;
+    for (auto i=0;i<rank;i++) {
+        nchunks_dim[i] = (dims[i] + chunks[i] - 1) / chunks[i];
+        nchunks *= nchunks_dim[i];
+    }
+    strides[rank-1] = elsize;
+    for (auto i=rank-2;i>=0;i--) strides[i] = strides[i+1] * dims[i+1];
+    hashes.resize(nchunks);
+
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (long long ichunk=0; ichunk<nchunks; ichunk++) {
+        std::vector<hsize_t> start(rank), count(rank), idx(rank, 0);
+        _chunk_bounds(ichunk, rank, dims, chunks, nchunks_dim.data(), start.data(), count.data());
+        size_t rowlen = count[rank-1] * elsize;
+        uint64_t h = 0;
+        // walk the rows of the chunk, the last dimension being contiguous in memory
+        while (true) {
+            size_t offset = 0;
+            for (auto i=0;i<rank;i++) offset += (start[i] + idx[i]) * strides[i];
+            h = hdf5_hash64((const char *)data + offset, rowlen, h);
+            int d = rank - 2;
+            while (d >= 0 && ++idx[d] == count[d]) {
+                idx[d] = 0;
+                d--;
+            }
+            if (d < 0) break;
+        }
+        hashes[ichunk] = h;
+    }
+}
+
+/// copy a file, sharing its blocks with the copy where the file system can
+/// clone them (btrfs, XFS and others) so that only the blocks rewritten later
+/// take space and time, otherwise copying its contents
+static bool _copy_checkpoint_file(const std::string &from, const std::string &to)
+{
+#if defined(__linux__) && defined(FICLONE)
+    int in_fd = open(from.c_str(), O_RDONLY);
+    if (in_fd >= 0) {
+        struct stat st;
+        bool icloned = false;
+        int out_fd = -1;
+        if (fstat(in_fd, &st) == 0) out_fd = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777);
+        if (out_fd >= 0) {
+            icloned = (ioctl(out_fd, FICLONE, in_fd) == 0);
+            ::close(out_fd);
+        }
+        ::close(in_fd);
+        if (icloned) return true;
+    }
+#endif
+    std::ifstream in(from.c_str(), std::ios::binary);
+    std::ofstream out(to.c_str(), std::ios::binary | std::ios::trunc);
+    out << in.rdbuf();
+    return out.good();
+}
+
+void H5OutputFile::_write_checkpoint_marker(int committed, unsigned long long generation)
+{
+    const char *names[2] = {"checkpoint_committed", "checkpoint_generation"};
+    hid_t types[2] = {H5T_NATIVE_INT, H5T_NATIVE_ULLONG};
+    const void *vals[2] = {&committed, &generation};
+    for (auto i=0;i<2;i++) {
+        hid_t attr_id;
+        if (H5Aexists(file_id, names[i]) > 0) {
+            attr_id = H5Aopen(file_id, names[i], H5P_DEFAULT);
+        }
+        else {
+            hid_t dspace_id = H5Screate(H5S_SCALAR);
+            attr_id = H5Acreate(file_id, names[i], types[i], dspace_id, H5P_DEFAULT, H5P_DEFAULT);
+            H5Sclose(dspace_id);
+        }
+        if (attr_id < 0 || H5Awrite(attr_id, types[i], vals[i]) < 0)
+            io_error(std::string("Unable to write checkpoint marker ")+names[i]);
+        H5Aclose(attr_id);
+    }
+}
+
+void H5OutputFile::begin_checkpoint(std::string filename, bool flag_copy,
+    int taskID, bool iparallelopen)
+{
+    if (checkpoint_active) io_error("Attempted to begin checkpoint when one is already in progress!");
+    checkpoint_filename = filename;
+    checkpoint_workname = filename;
+    bool iexists = std::ifstream(filename.c_str()).good();
+    if (flag_copy) {
+        checkpoint_workname = filename + ".checkpoint";
+#ifdef USEPARALLELHDF
+        if (ThisWriteTask == 0) {
+#endif
+        if (iexists && !_copy_checkpoint_file(filename, checkpoint_workname))
+            io_error(std::string("Failed to copy checkpoint file: ")+filename);
+#ifdef USEPARALLELHDF
+        }
+        MPI_Barrier(mpi_comm_write);
+#endif
+    }
+    if (iexists) append(checkpoint_workname, H5F_ACC_RDWR, taskID, iparallelopen);
+    else create(checkpoint_workname, H5F_ACC_TRUNC, taskID, iparallelopen);
+    checkpoint_active = true;
+    if (file_id < 0) return;
+
+    unsigned long long generation = 0;
+    if (H5Aexists(file_id, "checkpoint_generation") > 0) {
+        generation = read_attribute<unsigned long long>("checkpoint_generation");
+    }
+    _write_checkpoint_marker(0, generation);
+    H5Fflush(file_id, H5F_SCOPE_GLOBAL);
+}
+
+void H5OutputFile::write_checkpoint_dataset_nd(H5PathView name, int rank, hsize_t *dims, void *data,
+    hid_t memtype_id, hid_t filetype_id)
+{
+    if (!checkpoint_active) io_error("Attempted to write checkpoint dataset outside of a checkpoint!");
+    if (file_id < 0) return;
+    if (filetype_id < 0) filetype_id = memtype_id;
+    std::string hashname = name + "_chunkhash";
+    std::vector<hsize_t> chunks, stored_dims(rank), nchunks_dim(rank), start(rank), count(rank);
+    std::vector<uint64_t> hashes, stored_hashes;
+    hid_t dset_id = -1, dspace_id, memspace_id, prop_id;
+    herr_t ret;
+    bool nonzero_size = true;
+    for (auto i=0;i<rank;i++) if (dims[i] == 0) nonzero_size = false;
+
+    // reuse the dataset of the previous checkpoint if it has the same shape
+    if (_exists_path(name)) {
+        dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+        dspace_id = H5Dget_space(dset_id);
+        prop_id = H5Dget_create_plist(dset_id);
+        bool imatch = (H5Sget_simple_extent_ndims(dspace_id) == rank);
+        if (imatch) {
+            H5Sget_simple_extent_dims(dspace_id, stored_dims.data(), NULL);
+            for (auto i=0;i<rank;i++) imatch = imatch && (stored_dims[i] == dims[i]);
+        }
+        if (imatch) {
+            if (H5Pget_layout(prop_id) == H5D_CHUNKED) {
+                chunks.resize(rank);
+                H5Pget_chunk(prop_id, rank, chunks.data());
+            }
+            else chunks.assign(dims, dims+rank);
+        }
+        H5Pclose(prop_id);
+        H5Sclose(dspace_id);
+        if (!imatch) {
+            H5Dclose(dset_id);
+            H5Ldelete(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+            if (_exists_path(hashname)) H5Ldelete(file_id, hashname.c_str(), H5P_DEFAULT);
+            dset_id = -1;
+        }
+    }
+    if (dset_id < 0) {
+        // new dataset, always chunked so unchanged chunks can be skipped next time
+        if (nonzero_size) {
+#ifdef USEPARALLELHDF
+            std::vector<hsize_t> dims_tot(dims, dims+rank);
+#endif
+            _set_chunks(chunks, rank, dims,
+#ifdef USEPARALLELHDF
+                dims_tot,
+#endif
+                false
+            );
+            if (chunks.empty()) chunks.assign(dims, dims+rank);
+#ifdef USEHDFCOMPRESSION
+            prop_id = _set_compression(rank, chunks);
+#else
+            prop_id = H5Pcreate(H5P_DATASET_CREATE);
+            H5Pset_chunk(prop_id, rank, chunks.data());
+#endif
+        }
+        else prop_id = H5P_DEFAULT;
+        dspace_id = H5Screate_simple(rank, dims, NULL);
+        dset_id = H5Dcreate(file_id, H5PathBuffer(name).c_str(), filetype_id, dspace_id,
+            H5P_DEFAULT, prop_id, H5P_DEFAULT);
+        if (dset_id < 0) io_error(std::string("Failed to create dataset: ")+name);
+        H5Pclose(prop_id);
+        H5Sclose(dspace_id);
+    }
+    if (!nonzero_size) {
+        H5Dclose(dset_id);
+        return;
+    }
+
+    // hash the chunks and compare with the stored hashes
+    _hash_chunks(hashes, data, H5Tget_size(memtype_id), rank, dims, chunks.data());
+    if (_exists_path(hashname)) {
+        hid_t hash_id = H5Dopen(file_id, hashname.c_str(), H5P_DEFAULT);
+        hid_t hash_space_id = H5Dget_space(hash_id);
+        if (H5Sget_simple_extent_npoints(hash_space_id) == (hssize_t)hashes.size()) {
+            stored_hashes.resize(hashes.size());
+            H5Dread(hash_id, H5T_NATIVE_UINT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, stored_hashes.data());
+        }
+        H5Sclose(hash_space_id);
+        H5Dclose(hash_id);
+        if (stored_hashes.empty()) H5Ldelete(file_id, hashname.c_str(), H5P_DEFAULT);
+    }
+
+    // select all changed chunks and write them together
+    for (auto i=0;i<rank;i++) nchunks_dim[i] = (dims[i] + chunks[i] - 1) / chunks[i];
+    dspace_id = H5Dget_space(dset_id);
+    memspace_id = H5Screate_simple(rank, dims, NULL);
+    H5Sselect_none(dspace_id);
+    H5Sselect_none(memspace_id);
+    hsize_t nchanged = 0;
+    for (hsize_t ichunk=0; ichunk<hashes.size(); ichunk++) {
+        if (!stored_hashes.empty() && stored_hashes[ichunk] == hashes[ichunk]) continue;
+        _chunk_bounds(ichunk, rank, dims, chunks.data(), nchunks_dim.data(), start.data(), count.data());
+        H5Sselect_hyperslab(dspace_id, H5S_SELECT_OR, start.data(), NULL, count.data(), NULL);
+        H5Sselect_hyperslab(memspace_id, H5S_SELECT_OR, start.data(), NULL, count.data(), NULL);
+        nchanged++;
+    }
+    if (nchanged > 0) {
+        ret = H5Dwrite(dset_id, memtype_id, memspace_id, dspace_id, H5P_DEFAULT, data);
+        if (ret < 0) io_error(std::string("Failed to write checkpoint dataset: ")+name);
+    }
+    H5Sclose(memspace_id);
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+
+    // and store the new hashes
+    if (nchanged > 0) {
+        hsize_t nhashes = hashes.size();
+        hid_t hash_id;
+        if (stored_hashes.empty()) {
+            dspace_id = H5Screate_simple(1, &nhashes, NULL);
+            hash_id = H5Dcreate(file_id, hashname.c_str(), H5T_STD_U64LE, dspace_id,
+                H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+            H5Sclose(dspace_id);
+        }
+        else hash_id = H5Dopen(file_id, hashname.c_str(), H5P_DEFAULT);
+        if (hash_id < 0) io_error(std::string("Failed to create chunk hash dataset: ")+hashname);
+        ret = H5Dwrite(hash_id, H5T_NATIVE_UINT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, hashes.data());
+        if (ret < 0) io_error(std::string("Failed to write chunk hash dataset: ")+hashname);
+        H5Dclose(hash_id);
+    }
+}
+
+void H5OutputFile::commit_checkpoint()
+{
+    if (!checkpoint_active) io_error("Attempted to commit checkpoint when none is in progress!");
+    if (file_id >= 0) {
+        unsigned long long generation = read_attribute<unsigned long long>("checkpoint_generation");
+        _write_checkpoint_marker(1, generation + 1);
+    }
+    close();
+    if (checkpoint_workname != checkpoint_filename) {
+#ifdef USEPARALLELHDF
+        if (ThisWriteTask == 0) {
+#endif
+        if (std::rename(checkpoint_workname.c_str(), checkpoint_filename.c_str()) != 0)
+            io_error(std::string("Failed to replace checkpoint file: ")+checkpoint_filename);
+#ifdef USEPARALLELHDF
+        }
+        MPI_Barrier(mpi_comm_write);
+#endif
+    }
+    checkpoint_active = false;
+}
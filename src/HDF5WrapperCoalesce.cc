@@ -0,0 +1,139 @@
+#include "HDF5Wrapper.h"
+
+// Write coalescing. Writes of hyperslabs to an existing dataset are gathered
+// into a pending block per dataset, a run of rows along the first dimension
+// with the same selection in the other dimensions. Writes adjacent to or
+// overlapping the block extend it (later writes win where they overlap) and
+// the block is written with a single H5Dwrite when it can no longer grow or
+// a size or age threshold is passed.
+
+bool H5OutputFile::_coalesce_write(H5PathView name, int rank, const hsize_t *dims,
+    const void *data, const std::vector<hsize_t> &count, const std::vector<hsize_t> &start,
+    hid_t memtype_id)
+{
+    if (!coalesce_active || rank < 1 || count.size() != rank || start.size() != rank) return false;
+#ifdef USEPARALLELHDF
+    // writes to a file opened through the MPI-IO driver are collective and
+    // must be issued by every task when called, so they are never held back
+    hid_t fapl_id = H5Fget_access_plist(file_id);
+    bool impio = (H5Pget_driver(fapl_id) == H5FD_MPIO);
+    H5Pclose(fapl_id);
+    if (impio) return false;
+#endif
+
+    // the selected elements as a contiguous block of rows
+    hsize_t npoints = 1;
+    bool iwhole = true;
+    for (auto i=0;i<rank;i++) {
+        npoints *= count[i];
+        if (start[i] != 0 || count[i] != dims[i]) iwhole = false;
+    }
+    if (npoints == 0) return true;
+    size_t elsize = H5Tget_size(memtype_id);
+    size_t row_bytes = elsize * (npoints / count[0]);
+    H5StagingBuffer selected;
+    const char *rows = (const char *)data;
+    if (!iwhole) {
+        hid_t memspace_id = H5Screate_simple(rank, dims, NULL);
+        H5Sselect_hyperslab(memspace_id, H5S_SELECT_SET, start.data(), NULL, count.data(), NULL);
+        selected = staging_pool.acquire(npoints * elsize);
+        H5Dgather(memspace_id, data, memtype_id, npoints * elsize, selected.data(), NULL, NULL);
+        H5Sclose(memspace_id);
+        rows = (const char *)selected.data();
+    }
+
+    hsize_t lo = start[0], hi = start[0] + count[0];
+    const std::string key = name.str();
+    auto it = coalesced_writes.find(key);
+    if (it != coalesced_writes.end()) {
+        _CoalescedWrite &block = it->second;
+        bool icompatible = (block.rank == rank && H5Tequal(block.memtype_id, memtype_id) > 0
+            && lo <= block.hi && hi >= block.lo);
+        for (auto i=1;i<rank && icompatible;i++) {
+            icompatible = (block.start[i] == start[i] && block.count[i] == count[i]);
+        }
+        if (!icompatible) {
+            _flush_coalesced(name);
+            it = coalesced_writes.end();
+        }
+    }
+    if (it == coalesced_writes.end()) {
+        _CoalescedWrite &block = coalesced_writes[key];
+        block.memtype_id = H5Tcopy(memtype_id);
+        block.rank = rank;
+        block.start = start;
+        block.count = count;
+        block.lo = block.hi = lo;
+        block.row_bytes = row_bytes;
+        block.first_write = std::chrono::steady_clock::now();
+        it = coalesced_writes.find(key);
+    }
+
+    // grow the block, moving the rows already held if it grows downwards
+    _CoalescedWrite &block = it->second;
+    hsize_t new_lo = std::min(block.lo, lo), new_hi = std::max(block.hi, hi);
+    size_t nbytes = (new_hi - new_lo) * row_bytes;
+    if (new_lo < block.lo || nbytes > block.buf.size()) {
+        H5StagingBuffer buf = staging_pool.acquire(std::max(nbytes, 2 * block.buf.size()));
+        if (block.hi > block.lo) {
+            std::memcpy((char *)buf.data() + (block.lo - new_lo) * row_bytes, block.buf.data(),
+                (block.hi - block.lo) * row_bytes);
+        }
+        block.buf = std::move(buf);
+    }
+    if (hi > lo) std::memcpy((char *)block.buf.data() + (lo - new_lo) * row_bytes, rows, (hi - lo) * row_bytes);
+    coalesced_bytes += ((new_hi - new_lo) - (block.hi - block.lo)) * row_bytes;
+    block.lo = new_lo;
+    block.hi = new_hi;
+
+    double age = 0;
+    for (auto &pending:coalesced_writes) {
+        age = std::max(age, std::chrono::duration<double>(std::chrono::steady_clock::now() - pending.second.first_write).count());
+    }
+    if (coalesced_bytes >= coalesce_max_bytes || age >= coalesce_max_seconds) _flush_coalesced();
+    return true;
+}
+
+void H5OutputFile::_flush_coalesced(H5PathView name)
+{
+    // called before every access to a dataset, so nothing is built unless writes are pending
+    if (coalesced_writes.empty()) return;
+    auto it = coalesced_writes.find(name.str());
+    if (it == coalesced_writes.end()) return;
+    _CoalescedWrite &block = it->second;
+    hsize_t nrows = block.hi - block.lo;
+    if (nrows > 0) {
+        hid_t dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+        if (dset_id < 0) io_error(std::string("Failed to open dataset to write coalesced writes: ")+name);
+        hid_t dspace_id = H5Dget_space(dset_id);
+        std::vector<hsize_t> start(block.start), count(block.count);
+        start[0] = block.lo;
+        count[0] = nrows;
+        hsize_t npoints = nrows * block.row_bytes / H5Tget_size(block.memtype_id);
+        H5Sselect_hyperslab(dspace_id, H5S_SELECT_SET, start.data(), NULL, count.data(), NULL);
+        hid_t memspace_id = H5Screate_simple(1, &npoints, NULL);
+        if (H5Dwrite(dset_id, block.memtype_id, memspace_id, dspace_id, H5P_DEFAULT, block.buf.data()) < 0)
+            io_error(std::string("Failed to write coalesced writes to dataset: ")+name);
+        H5Sclose(memspace_id);
+        H5Sclose(dspace_id);
+        H5Dclose(dset_id);
+        // statistics of the merged block count overlapping writes once
+        if (write_statistics) _write_statistics(name, block.buf.data(), block.memtype_id, 1, &npoints, false, true);
+    }
+    coalesced_bytes -= nrows * block.row_bytes;
+    H5Tclose(block.memtype_id);
+    coalesced_writes.erase(it);
+}
+
+void H5OutputFile::_flush_coalesced()
+{
+    while (coalesced_writes.size() > 0) _flush_coalesced(coalesced_writes.begin()->first);
+}
+
+void H5OutputFile::flush()
+{
+    _flush_coalesced();
+    if (file_id >= 0) H5Fflush(file_id, H5F_SCOPE_LOCAL);
+    swmr_pending_bytes = 0;
+    swmr_last_flush = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,129 @@
+#include "HDF5Wrapper.h"
+
+// Write decompositions. With recording active, every dataset written in
+// parallel gets a companion dataset name_decomposition (ntasks x 2) holding
+// the first row and number of rows written by each task. On restart with a
+// different number of tasks the rows are split so that each new task reads
+// one contiguous run: whole blocks of old tasks when there are fewer new
+// tasks, the block of one old task cut at chunk boundaries when there are more.
+
+void H5OutputFile::_write_decomposition(H5PathView name,
+    const std::vector<unsigned long long> &counts)
+{
+    hid_t dset_id, dspace_id, memspace_id, prop_id;
+    bool iwrite;
+    std::vector<unsigned long long> decomposition(2*counts.size());
+    unsigned long long offset = 0;
+    for (auto t=0;t<counts.size();t++) {
+        decomposition[2*t] = offset;
+        decomposition[2*t+1] = counts[t];
+        offset += counts[t];
+    }
+    // every task holds the full decomposition so it is written without a parallel hyperslab
+    std::string decomposition_name = name + "_decomposition";
+    hsize_t dims[2] = {counts.size(), 2};
+    _create_dataset_for_write(decomposition_name, 2, dims, H5T_NATIVE_ULLONG,
+        dset_id, dspace_id, memspace_id, prop_id, iwrite,
+        false, false, false, false);
+    if (iwrite) {
+        if (H5Dwrite(dset_id, H5T_NATIVE_ULLONG, memspace_id, dspace_id, prop_id, decomposition.data()) < 0)
+            io_error(std::string("Failed to write decomposition: ")+decomposition_name);
+    }
+    _close_dataset_for_write(dset_id, dspace_id, memspace_id, prop_id, false, false);
+}
+
+void H5OutputFile::_record_decomposition(H5PathView name, hsize_t nrows_local,
+    bool flag_parallel, bool flag_first_dim_parallel)
+{
+#ifdef USEPARALLELHDF
+    if (!write_decomposition || !flag_parallel || !flag_first_dim_parallel) return;
+    // the extents exchanged for the write are those after any redistribution
+    // to whole chunks, so the rows each task supplied are gathered here
+    unsigned long long nlocal = nrows_local;
+    std::vector<unsigned long long> counts(NProcsWrite);
+    MPI_Allgather(&nlocal, 1, MPI_UNSIGNED_LONG_LONG, counts.data(), 1, MPI_UNSIGNED_LONG_LONG,
+        mpi_comm_write);
+    _write_decomposition(name, counts);
+#endif
+}
+
+bool H5OutputFile::read_decomposition(H5PathView name,
+    std::vector<unsigned long long> &offsets, std::vector<unsigned long long> &counts)
+{
+    std::string decomposition_name = name + "_decomposition";
+    offsets.clear();
+    counts.clear();
+    if (!_exists_path(decomposition_name)) return false;
+    std::vector<hsize_t> dims;
+    std::vector<unsigned long long> decomposition;
+    hid_t dset_id = H5Dopen(file_id, decomposition_name.c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open decomposition: ")+decomposition_name);
+    hid_t dspace_id = H5Dget_space(dset_id);
+    dims.resize(H5Sget_simple_extent_ndims(dspace_id));
+    H5Sget_simple_extent_dims(dspace_id, dims.data(), NULL);
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+    decomposition.resize(dims[0] * 2);
+    if (dims[0] > 0) read_from_dataset_nd(decomposition_name, decomposition.data(), {}, {});
+    for (auto t=0;t<dims[0];t++) {
+        offsets.push_back(decomposition[2*t]);
+        counts.push_back(decomposition[2*t+1]);
+    }
+    return true;
+}
+
+void H5OutputFile::restart_rows(H5PathView name, int ntasks, int itask,
+    hsize_t &row_offset, hsize_t &nrows)
+{
+    hid_t dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset: ")+name);
+    hid_t dspace_id = H5Dget_space(dset_id);
+    int rank = H5Sget_simple_extent_ndims(dspace_id);
+    if (rank == 0) {
+        H5Sclose(dspace_id);
+        H5Dclose(dset_id);
+        io_error(std::string("Cannot split a scalar dataset: ")+name);
+    }
+    std::vector<hsize_t> dims(rank);
+    H5Sget_simple_extent_dims(dspace_id, dims.data(), NULL);
+    H5Sclose(dspace_id);
+    // cuts inside the block of a task follow the chunks of the dataset
+    hsize_t chunk_rows = 1;
+    hid_t prop_id = H5Dget_create_plist(dset_id);
+    if (H5Pget_layout(prop_id) == H5D_CHUNKED) {
+        std::vector<hsize_t> chunks(rank);
+        H5Pget_chunk(prop_id, rank, chunks.data());
+        chunk_rows = chunks[0];
+    }
+    H5Pclose(prop_id);
+    H5Dclose(dset_id);
+
+    std::vector<unsigned long long> offsets, counts;
+    if (!read_decomposition(name, offsets, counts) || offsets.size() == 0) {
+        // without a stored decomposition the dataset is a single block
+        offsets.assign(1, 0);
+        counts.assign(1, dims[0]);
+    }
+    unsigned long long nold = offsets.size();
+    std::vector<unsigned long long> start(ntasks + 1);
+    start[ntasks] = dims[0];
+    if (ntasks <= nold) {
+        // new task t reads the blocks of old tasks [nold*t/ntasks, nold*(t+1)/ntasks)
+        for (auto t=0;t<ntasks;t++) start[t] = offsets[nold * t / ntasks];
+    }
+    else {
+        // old block k is cut among new tasks [ntasks*k/nold, ntasks*(k+1)/nold)
+        for (auto k=0;k<nold;k++) {
+            unsigned long long first = ntasks * k / nold, last = ntasks * (k + 1) / nold;
+            unsigned long long block_start = offsets[k], block_end = offsets[k] + counts[k];
+            start[first] = block_start;
+            for (auto t=first+1;t<last;t++) {
+                unsigned long long cut = block_start + counts[k] * (t - first) / (last - first);
+                cut = ((cut + chunk_rows / 2) / chunk_rows) * chunk_rows;
+                start[t] = std::min(std::max(cut, start[t-1]), block_end);
+            }
+        }
+    }
+    row_offset = start[itask];
+    nrows = start[itask+1] - start[itask];
+}
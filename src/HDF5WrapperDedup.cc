@@ -0,0 +1,78 @@
+#include "HDF5Wrapper.h"
+
+// Deduplication of identical datasets. The buffer of every large enough
+// dataset written is hashed twice with different seeds, the seeds derived
+// from the encoded memory and file types and the dimensions so that equal
+// bytes of a different type or shape never match. A later write whose hashes
+// match a dataset written earlier to the same file becomes a hard link.
+
+static const uint64_t DEDUPCHECKSEED = 0x9e3779b97f4a7c15ULL;
+
+/// hash the binary description of a datatype
+static uint64_t _hash_type(hid_t type_id, uint64_t seed)
+{
+    size_t nalloc = 0;
+    H5Tencode(type_id, NULL, &nalloc);
+    std::vector<unsigned char> buf(nalloc);
+    if (nalloc > 0) H5Tencode(type_id, buf.data(), &nalloc);
+    return hdf5_hash64(buf.data(), buf.size(), seed);
+}
+
+bool H5OutputFile::_dedup_lookup(H5PathView name, const void *data,
+    hid_t memtype_id, hid_t filetype_id, int rank, const hsize_t *dims,
+    bool flag_parallel, _DedupKey &key)
+{
+    key.ivalid = false;
+    if (!dedup_active) return false;
+    unsigned long long nbytes = H5Tget_size(memtype_id);
+    for (auto i=0;i<rank;i++) nbytes *= dims[i];
+
+    uint64_t seed = _hash_type(filetype_id, _hash_type(memtype_id, 0));
+    seed = hdf5_hash64(&rank, sizeof(rank), seed);
+#ifdef USEPARALLELHDF
+    // in parallel the hashes of the local parts are combined so all tasks agree
+    if (flag_parallel) {
+        // the first dimension is split across tasks, covered by the gathered sizes
+        if (rank > 1) seed = hdf5_hash64(dims + 1, (rank - 1)*sizeof(hsize_t), seed);
+        uint64_t local[3] = {hdf5_hash64(data, nbytes, seed), hdf5_hash64(data, nbytes, seed ^ DEDUPCHECKSEED), nbytes};
+        std::vector<uint64_t> all(3*NProcsWrite);
+        MPI_Allgather(local, 3, MPI_UINT64_T, all.data(), 3, MPI_UINT64_T, mpi_comm_write);
+        nbytes = 0;
+        for (auto i=0;i<NProcsWrite;i++) nbytes += all[3*i+2];
+        key.hash = hdf5_hash64(all.data(), all.size()*sizeof(uint64_t), seed);
+        key.check = hdf5_hash64(all.data(), all.size()*sizeof(uint64_t), seed ^ DEDUPCHECKSEED);
+    }
+    else
+#endif
+    {
+        seed = hdf5_hash64(dims, rank*sizeof(hsize_t), seed);
+        key.hash = hdf5_hash64(data, nbytes, seed);
+        key.check = hdf5_hash64(data, nbytes, seed ^ DEDUPCHECKSEED);
+    }
+    if (nbytes < dedup_min_bytes) return false;
+    key.ivalid = true;
+
+    auto range = dedup_index.equal_range(key.hash);
+    for (auto it=range.first; it!=range.second; it++) {
+        if (it->second.first != key.check) continue;
+        const std::string &orgname = it->second.second;
+        if (!_exists_path(orgname)) continue;
+        if (create_link(orgname, name.str()) < 0) io_error(std::string("Failed to link duplicate dataset: ")+name);
+        // the zone map and decomposition of the original serve the link too
+        const char *companions[2] = {"_zonemap", "_decomposition"};
+        for (auto &companion:companions) {
+            if (_exists_path(orgname+companion) && !_exists_path(name+companion)) {
+                create_link(orgname+companion, name+companion);
+            }
+        }
+        key.ivalid = false;
+        return true;
+    }
+    return false;
+}
+
+void H5OutputFile::_dedup_record(H5PathView name, const _DedupKey &key)
+{
+    if (!key.ivalid) return;
+    dedup_index.insert(std::make_pair(key.hash, std::make_pair(key.check, name.str())));
+}
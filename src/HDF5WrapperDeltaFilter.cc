@@ -0,0 +1,260 @@
+#include "HDF5Wrapper.h"
+#include <type_traits>
+
+// Delta filter for integer datasets. Sorted IDs, offsets and indices change
+// by small steps, so each chunk is stored as the differences between
+// consecutive values, zigzag encoded to make small negative steps small
+// unsigned numbers, in blocks of DELTABLOCK values. Each block keeps the
+// minimum of its encoded differences as a varint and the remainder
+// bit-packed with the fewest bits that hold the largest of them, so a run of
+// equal steps packs to no bits at all. The difference, zigzag and reduction
+// loops work on whole blocks without branches so the compiler can vectorize
+// them. The filter is optional: a chunk that does not shrink is stored as is.
+//
+// Encoded chunk: version byte, element size byte, varint number of values,
+// varint zigzag first value, then per block a byte holding the bit width,
+// the varint minimum and the packed values as little endian 64 bit words.
+
+static const unsigned char DELTAVERSION = 1;
+/// values per block sharing a bit width, a multiple of 64 so blocks are whole words
+static const size_t DELTABLOCK = 128;
+
+template<typename U> static inline U _zigzag(U v)
+{
+    typedef typename std::make_signed<U>::type S;
+    return (v << 1) ^ (U)((S)v >> (sizeof(U) * 8 - 1));
+}
+template<typename U> static inline U _unzigzag(U v)
+{
+    return (v >> 1) ^ (U)(-(v & 1));
+}
+
+static inline size_t _put_varint(unsigned char *out, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (unsigned char)v;
+    return n;
+}
+/// read a varint, returns 0 if it runs past end
+static inline size_t _get_varint(const unsigned char *in, const unsigned char *end, uint64_t &v)
+{
+    v = 0;
+    for (size_t n=0; n<10 && in + n < end; n++) {
+        v |= (uint64_t)(in[n] & 0x7f) << (7 * n);
+        if ((in[n] & 0x80) == 0) return n + 1;
+    }
+    return 0;
+}
+
+static inline void _store_le64(unsigned char *out, uint64_t v)
+{
+    for (auto i=0;i<8;i++) out[i] = (unsigned char)(v >> (8 * i));
+}
+static inline uint64_t _load_le64(const unsigned char *in)
+{
+    uint64_t v = 0;
+    for (auto i=0;i<8;i++) v |= (uint64_t)in[i] << (8 * i);
+    return v;
+}
+
+static void _byteswap(unsigned char *buf, size_t n, size_t elsize)
+{
+    for (size_t i=0;i<n;i++) std::reverse(buf + i * elsize, buf + (i + 1) * elsize);
+}
+
+static bool _native_little_endian()
+{
+    uint32_t one = 1;
+    unsigned char c;
+    std::memcpy(&c, &one, 1);
+    return c == 1;
+}
+
+/// encode n values into out (sized for the worst case), returning the bytes used
+template<typename U> static size_t _delta_encode(const U *in, size_t n, unsigned char *out)
+{
+    const unsigned int nbits = sizeof(U) * 8;
+    unsigned char *p = out;
+    *p++ = DELTAVERSION;
+    *p++ = sizeof(U);
+    p += _put_varint(p, n);
+    if (n == 0) return p - out;
+    p += _put_varint(p, _zigzag(in[0]));
+
+    U delta[DELTABLOCK];
+    for (size_t first=1; first<n; first+=DELTABLOCK) {
+        size_t m = std::min(DELTABLOCK, n - first);
+        for (size_t i=0;i<m;i++) delta[i] = _zigzag((U)(in[first + i] - in[first + i - 1]));
+        U lo = delta[0];
+        for (size_t i=1;i<m;i++) lo = std::min(lo, delta[i]);
+        U bits = 0;
+        for (size_t i=0;i<m;i++) {
+            delta[i] -= lo;
+            bits |= delta[i];
+        }
+        unsigned int width = 0;
+        while (width < nbits && (bits >> width) != 0) width++;
+        *p++ = (unsigned char)width;
+        p += _put_varint(p, lo);
+        if (width == 0) continue;
+
+        size_t nwords = (m * width + 63) / 64;
+        uint64_t words[DELTABLOCK];
+        std::memset(words, 0, nwords * sizeof(uint64_t));
+        for (size_t i=0;i<m;i++) {
+            size_t bitpos = i * width, word = bitpos / 64, shift = bitpos % 64;
+            uint64_t v = delta[i];
+            words[word] |= v << shift;
+            if (shift + width > 64) words[word + 1] |= v >> (64 - shift);
+        }
+        for (size_t w=0;w<nwords;w++, p+=8) _store_le64(p, words[w]);
+    }
+    return p - out;
+}
+
+/// decode an encoded chunk into out holding n values, returns false if malformed
+template<typename U> static bool _delta_decode(const unsigned char *p, const unsigned char *end,
+    size_t n, U *out)
+{
+    if (n == 0) return true;
+    uint64_t v;
+    size_t len = _get_varint(p, end, v);
+    if (len == 0) return false;
+    p += len;
+    out[0] = _unzigzag((U)v);
+
+    U delta[DELTABLOCK];
+    for (size_t first=1; first<n; first+=DELTABLOCK) {
+        size_t m = std::min(DELTABLOCK, n - first);
+        if (p >= end) return false;
+        unsigned int width = *p++;
+        if (width > sizeof(U) * 8) return false;
+        len = _get_varint(p, end, v);
+        if (len == 0) return false;
+        p += len;
+        U lo = (U)v;
+        size_t nwords = (m * width + 63) / 64;
+        if (p + nwords * 8 > end) return false;
+        uint64_t mask = (width == 64) ? ~(uint64_t)0 : (((uint64_t)1 << width) - 1);
+        for (size_t i=0;i<m;i++) {
+            size_t bitpos = i * width, word = bitpos / 64, shift = bitpos % 64;
+            uint64_t x = (width == 0) ? 0 : _load_le64(p + 8 * word) >> shift;
+            if (shift + width > 64) x |= _load_le64(p + 8 * (word + 1)) << (64 - shift);
+            delta[i] = (U)(x & mask);
+        }
+        p += nwords * 8;
+        for (size_t i=0;i<m;i++) delta[i] = _unzigzag((U)(delta[i] + lo));
+        for (size_t i=0;i<m;i++) out[first + i] = out[first + i - 1] + delta[i];
+    }
+    return true;
+}
+
+static htri_t _delta_can_apply(hid_t dcpl_id, hid_t type_id, hid_t space_id)
+{
+    size_t size = H5Tget_size(type_id);
+    return (H5Tget_class(type_id) == H5T_INTEGER && (size == 4 || size == 8)) ? 1 : 0;
+}
+
+/// store the element size and byte order of the dataset type and the number
+/// of elements in a chunk in the filter parameters
+static herr_t _delta_set_local(hid_t dcpl_id, hid_t type_id, hid_t space_id)
+{
+    unsigned int flags;
+    size_t nelmts = 0;
+    unsigned int values[3];
+    hsize_t chunks[H5S_MAX_RANK];
+    if (H5Pget_filter_by_id2(dcpl_id, H5Z_FILTER_HDF5WRAPPER_DELTA, &flags, &nelmts, NULL, 0, NULL, NULL) < 0) return -1;
+    int rank = H5Pget_chunk(dcpl_id, H5S_MAX_RANK, chunks);
+    if (rank <= 0) return -1;
+    // chunks are limited to 4 GB so their element count fits
+    hsize_t nchunk = 1;
+    for (auto i=0;i<rank;i++) nchunk *= chunks[i];
+    values[0] = (unsigned int)H5Tget_size(type_id);
+    values[1] = (unsigned int)H5Tget_order(type_id);
+    values[2] = (unsigned int)nchunk;
+    return H5Pmodify_filter(dcpl_id, H5Z_FILTER_HDF5WRAPPER_DELTA, flags, 3, values);
+}
+
+static size_t _delta_filter(unsigned int flags, size_t cd_nelmts, const unsigned int cd_values[],
+    size_t nbytes, size_t *buf_size, void **buf)
+{
+    if (cd_nelmts < 2) return 0;
+    size_t elsize = cd_values[0];
+    if (elsize != 4 && elsize != 8) return 0;
+    bool iswap = ((cd_values[1] == H5T_ORDER_LE) != _native_little_endian());
+    unsigned char *in = (unsigned char *)*buf;
+
+    if (flags & H5Z_FLAG_REVERSE) {
+        const unsigned char *end = in + nbytes;
+        uint64_t n;
+        if (nbytes < 3 || in[0] != DELTAVERSION || in[1] != elsize) return 0;
+        size_t len = _get_varint(in + 2, end, n);
+        if (len == 0) return 0;
+        // a corrupt count must not size the output, a chunk never holds more
+        // elements than the chunk shape, files written before the shape was
+        // stored are only checked against overflow
+        uint64_t nmax = (cd_nelmts >= 3) ? cd_values[2] : SIZE_MAX / elsize;
+        if (n > nmax) return 0;
+        size_t outbytes = n * elsize;
+        unsigned char *out = (unsigned char *)H5allocate_memory(std::max<size_t>(outbytes, 1), false);
+        if (out == NULL) return 0;
+        bool ok = (elsize == 4) ? _delta_decode(in + 2 + len, end, n, (uint32_t *)out)
+            : _delta_decode(in + 2 + len, end, n, (uint64_t *)out);
+        if (!ok) {
+            H5free_memory(out);
+            return 0;
+        }
+        if (iswap) _byteswap(out, n, elsize);
+        H5free_memory(*buf);
+        *buf = out;
+        *buf_size = std::max<size_t>(outbytes, 1);
+        return outbytes;
+    }
+
+    size_t n = nbytes / elsize;
+    // worst case: header, then per block its width, minimum and every value in full
+    size_t nblocks = (n + DELTABLOCK - 1) / DELTABLOCK;
+    size_t maxbytes = 2 + 2 * 10 + nblocks * (1 + 10) + n * elsize;
+    unsigned char *out = (unsigned char *)H5allocate_memory(maxbytes, false);
+    if (out == NULL) return 0;
+    if (iswap) _byteswap(in, n, elsize);
+    size_t outbytes = (elsize == 4) ? _delta_encode((const uint32_t *)in, n, out)
+        : _delta_encode((const uint64_t *)in, n, out);
+    if (iswap) _byteswap(in, n, elsize);
+    // not worth it, the optional filter is then skipped for this chunk
+    if (outbytes >= nbytes) {
+        H5free_memory(out);
+        return 0;
+    }
+    H5free_memory(*buf);
+    *buf = out;
+    *buf_size = maxbytes;
+    return outbytes;
+}
+
+void hdf5_register_delta_filter()
+{
+    if (H5Zfilter_avail(H5Z_FILTER_HDF5WRAPPER_DELTA) > 0) return;
+    static const H5Z_class2_t delta_class = {
+        H5Z_CLASS_T_VERS, H5Z_FILTER_HDF5WRAPPER_DELTA, 1, 1,
+        "hdf5wrapper delta zigzag bitpack", _delta_can_apply, _delta_set_local, _delta_filter
+    };
+    H5Zregister(&delta_class);
+}
+
+herr_t hdf5_set_delta_filter(hid_t dcpl_id)
+{
+    hdf5_register_delta_filter();
+    return H5Pset_filter(dcpl_id, H5Z_FILTER_HDF5WRAPPER_DELTA, H5Z_FLAG_OPTIONAL, 0, NULL);
+}
+
+bool H5OutputFile::_use_delta_filter(H5PathView name, hid_t filetype_id)
+{
+    if (std::find(delta_filter_datasets.begin(), delta_filter_datasets.end(), name) == delta_filter_datasets.end()) return false;
+    size_t size = H5Tget_size(filetype_id);
+    return H5Tget_class(filetype_id) == H5T_INTEGER && (size == 4 || size == 8);
+}
@@ -0,0 +1,81 @@
+#include "HDF5Wrapper.h"
+
+// Distributed reads. Every task reads its share of the rows of a dataset
+// with a single collective read, the shares being consecutive runs of rows
+// in task order as written by the parallel writes.
+
+#ifdef USEPARALLELHDF
+void H5OutputFile::_split_dataset_rows(H5PathView name, long long nlocal, double weight,
+    std::vector<hsize_t> &dims, hsize_t &row_offset)
+{
+    MPI_Comm comm = mpi_comm_write;
+    hid_t dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset: ")+name);
+    hid_t dspace_id = H5Dget_space(dset_id);
+    int rank = H5Sget_simple_extent_ndims(dspace_id);
+    dims.resize(rank);
+    H5Sget_simple_extent_dims(dspace_id, dims.data(), NULL);
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+    if (rank == 0) io_error(std::string("Cannot distribute a scalar dataset: ")+name);
+
+    unsigned long long nrows = dims[0];
+    std::vector<unsigned long long> start(NProcsWrite + 1, 0);
+    if (nlocal >= 0) {
+        // the requested counts in task order
+        unsigned long long n = nlocal;
+        std::vector<unsigned long long> counts(NProcsWrite);
+        MPI_Allgather(&n, 1, MPI_UNSIGNED_LONG_LONG, counts.data(), 1, MPI_UNSIGNED_LONG_LONG, comm);
+        for (auto t=0;t<NProcsWrite;t++) start[t+1] = start[t] + counts[t];
+        if (start[NProcsWrite] != nrows)
+            throw std::invalid_argument(std::string("Rows requested do not add up to the rows of dataset: ")+name);
+    }
+    else if (weight >= 0) {
+        // shares proportional to the weights, rounding the cumulative weights
+        std::vector<double> weights(NProcsWrite);
+        MPI_Allgather(&weight, 1, MPI_DOUBLE, weights.data(), 1, MPI_DOUBLE, comm);
+        double total = 0, cumulative = 0;
+        for (auto &w:weights) total += w;
+        if (!(total > 0)) throw std::invalid_argument("Weights of a distributed read must not all be zero");
+        for (auto t=0;t<NProcsWrite;t++) {
+            cumulative += weights[t];
+            start[t+1] = std::min(nrows, (unsigned long long)(nrows * (cumulative / total) + 0.5));
+        }
+        start[NProcsWrite] = nrows;
+    }
+    else {
+        for (auto t=0;t<NProcsWrite;t++) start[t+1] = nrows * (t + 1) / NProcsWrite;
+    }
+    row_offset = start[ThisWriteTask];
+    dims[0] = start[ThisWriteTask+1] - start[ThisWriteTask];
+}
+
+void H5OutputFile::read_dataset_distributed(H5PathView name, void *data,
+    const std::vector<hsize_t> &dims, hsize_t row_offset, hid_t memtype_id,
+    bool flag_collective)
+{
+    _flush_coalesced(name);
+    hid_t dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset: ")+name);
+    hid_t dspace_id = H5Dget_space(dset_id);
+    int rank = dims.size();
+    std::vector<hsize_t> start(rank, 0);
+    start[0] = row_offset;
+    hid_t memspace_id = H5Screate_simple(rank, dims.data(), NULL);
+    // tasks without rows still take part in the collective read
+    if (dims[0] > 0) {
+        H5Sselect_hyperslab(dspace_id, H5S_SELECT_SET, start.data(), NULL, dims.data(), NULL);
+    }
+    else {
+        H5Sselect_none(dspace_id);
+        H5Sselect_none(memspace_id);
+    }
+    hid_t prop_id = _create_mpi_transfer_properties(flag_collective);
+    herr_t ret = H5Dread(dset_id, memtype_id, memspace_id, dspace_id, prop_id, data);
+    H5Pclose(prop_id);
+    H5Sclose(memspace_id);
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+    if (ret < 0) io_error(std::string("Failed to read distributed dataset: ")+name);
+}
+#endif
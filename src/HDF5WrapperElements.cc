@@ -0,0 +1,140 @@
+#include "HDF5Wrapper.h"
+
+// Scattered reads and writes of rows given by index. The indices are sorted
+// and the distinct rows merged into runs so that the rows are accessed in
+// file order with a single read or write of the union of the runs, the
+// values being permuted between the caller's order and the file order in a
+// staging buffer.
+
+/// runs shorter than this on average are selected as points in 1D datasets,
+/// building a union of many single element hyperslabs being the slower
+static const double ELEMENTSMINRUNLENGTH = 4.0;
+
+/// sort the indices, setting the distinct rows in increasing order, for every
+/// index the position of its row among them and for every distinct row the
+/// last index referring to it (so the last of duplicated writes wins)
+static void _sort_element_indices(const std::vector<hsize_t> &indices,
+    std::vector<hsize_t> &rows, std::vector<hsize_t> &slot, std::vector<hsize_t> &source)
+{
+    std::vector<std::pair<hsize_t, hsize_t>> sorted(indices.size());
+    bool isorted = true;
+    for (auto i=0;i<indices.size();i++) {
+        sorted[i] = std::make_pair(indices[i], (hsize_t)i);
+        if (i > 0 && indices[i] <= indices[i-1]) isorted = false;
+    }
+    if (!isorted) std::sort(sorted.begin(), sorted.end());
+    rows.clear();
+    source.clear();
+    slot.resize(indices.size());
+    for (auto &s:sorted) {
+        if (rows.size() == 0 || rows.back() != s.first) {
+            rows.push_back(s.first);
+            source.push_back(s.second);
+        }
+        else {
+            source.back() = s.second;
+        }
+        slot[s.second] = rows.size() - 1;
+    }
+}
+
+hid_t H5OutputFile::_select_element_rows(hid_t dset_id, H5PathView name,
+    const std::vector<hsize_t> &rows, hsize_t &row_size)
+{
+    hid_t dspace_id = H5Dget_space(dset_id);
+    int rank = H5Sget_simple_extent_ndims(dspace_id);
+    std::vector<hsize_t> dims(rank), start(rank, 0), count(rank);
+    H5Sget_simple_extent_dims(dspace_id, dims.data(), NULL);
+    row_size = 1;
+    for (auto i=1;i<rank;i++) {
+        row_size *= dims[i];
+        count[i] = dims[i];
+    }
+    if (rows.size() > 0 && rows.back() >= dims[0]) {
+        H5Sclose(dspace_id);
+        io_error(std::string("Element index beyond the extent of dataset: ")+name);
+    }
+
+    // runs of consecutive rows
+    std::vector<hsize_t> run_start, run_count;
+    for (auto &row:rows) {
+        if (run_start.size() > 0 && run_start.back() + run_count.back() == row) {
+            run_count.back()++;
+        }
+        else {
+            run_start.push_back(row);
+            run_count.push_back(1);
+        }
+    }
+
+    H5Sselect_none(dspace_id);
+    if (rows.size() == 0) return dspace_id;
+    if (rank == 1 && rows.size() < ELEMENTSMINRUNLENGTH * run_start.size()) {
+        H5Sselect_elements(dspace_id, H5S_SELECT_SET, rows.size(), rows.data());
+    }
+    else {
+        for (auto irun=0;irun<run_start.size();irun++) {
+            start[0] = run_start[irun];
+            count[0] = run_count[irun];
+            H5Sselect_hyperslab(dspace_id, H5S_SELECT_OR, start.data(), NULL, count.data(), NULL);
+        }
+    }
+    return dspace_id;
+}
+
+void H5OutputFile::write_elements(H5PathView name, const std::vector<hsize_t> &indices,
+    const void *data, hid_t memtype_id)
+{
+    _flush_coalesced(name);
+    std::vector<hsize_t> rows, slot, source;
+    _sort_element_indices(indices, rows, slot, source);
+
+    hid_t dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset: ")+name);
+    hsize_t row_size;
+    hid_t dspace_id = _select_element_rows(dset_id, name, rows, row_size);
+    size_t row_bytes = row_size * H5Tget_size(memtype_id);
+    hsize_t npoints = rows.size() * row_size;
+    if (npoints > 0) {
+        // values of the distinct rows in file order
+        H5StagingBuffer buf = staging_pool.acquire(npoints * H5Tget_size(memtype_id));
+        char *out = (char *)buf.data();
+        const char *in = (const char *)data;
+        for (auto i=0;i<rows.size();i++) std::memcpy(out + i * row_bytes, in + source[i] * row_bytes, row_bytes);
+        hid_t memspace_id = H5Screate_simple(1, &npoints, NULL);
+        if (H5Dwrite(dset_id, memtype_id, memspace_id, dspace_id, H5P_DEFAULT, buf.data()) < 0)
+            io_error(std::string("Failed to write elements of dataset: ")+name);
+        H5Sclose(memspace_id);
+        if (write_statistics) _write_statistics(name, buf.data(), memtype_id, 1, &npoints, false, true);
+    }
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+}
+
+void H5OutputFile::read_elements(H5PathView name, const std::vector<hsize_t> &indices,
+    void *data, hid_t memtype_id)
+{
+    _flush_coalesced(name);
+    std::vector<hsize_t> rows, slot, source;
+    _sort_element_indices(indices, rows, slot, source);
+
+    hid_t dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset: ")+name);
+    hsize_t row_size;
+    hid_t dspace_id = _select_element_rows(dset_id, name, rows, row_size);
+    size_t row_bytes = row_size * H5Tget_size(memtype_id);
+    hsize_t npoints = rows.size() * row_size;
+    if (npoints > 0) {
+        H5StagingBuffer buf = staging_pool.acquire(npoints * H5Tget_size(memtype_id));
+        hid_t memspace_id = H5Screate_simple(1, &npoints, NULL);
+        if (H5Dread(dset_id, memtype_id, memspace_id, dspace_id, H5P_DEFAULT, buf.data()) < 0)
+            io_error(std::string("Failed to read elements of dataset: ")+name);
+        H5Sclose(memspace_id);
+        // back to the order of the indices, duplicated indices each getting a copy
+        const char *in = (const char *)buf.data();
+        char *out = (char *)data;
+        for (auto i=0;i<indices.size();i++) std::memcpy(out + i * row_bytes, in + slot[i] * row_bytes, row_bytes);
+    }
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+}
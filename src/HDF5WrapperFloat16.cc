@@ -0,0 +1,246 @@
+#include "HDF5Wrapper.h"
+
+#if defined(__F16C__) && defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Reduced precision storage types. The types are transient HDF5 float types
+// built from the native float so only the size of the mantissa and exponent
+// change. Conversion to and from the native float is done by hard conversion
+// functions registered with HDF5 that call the kernels below, which are
+// written as straight loops over blocks so that the compiler can vectorize
+// them (or use the F16C instructions when available).
+
+static hid_t hdf5_float16_id = -1;
+static hid_t hdf5_bfloat16_id = -1;
+
+/// number of elements converted per block inside an HDF5 conversion buffer
+static const size_t HDF5CONVERSIONBLOCK = 1024;
+
+static inline uint32_t _float_as_bits(float f)
+{
+    uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+}
+static inline float _bits_as_float(uint32_t u)
+{
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/// float to IEEE half with round to nearest even, overflow goes to inf
+/// and NaN stays a (quiet) NaN
+static inline uint16_t _float_to_float16(float f)
+{
+    const uint32_t f32infty = 255u << 23;
+    const uint32_t f16max = (127u + 16u) << 23;
+    const uint32_t denorm_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+    uint32_t u = _float_as_bits(f);
+    uint32_t sign = u & 0x80000000u;
+    uint16_t o;
+    u ^= sign;
+    if (u >= f16max) {
+        o = (u > f32infty) ? 0x7e00 : 0x7c00;
+    }
+    else if (u < (113u << 23)) {
+        // subnormal or zero, let the float add do the rounding
+        o = _float_as_bits(_bits_as_float(u) + _bits_as_float(denorm_magic)) - denorm_magic;
+    }
+    else {
+        uint32_t mant_odd = (u >> 13) & 1u;
+        u += (uint32_t(15 - 127) << 23) + 0xfffu;
+        u += mant_odd;
+        o = u >> 13;
+    }
+    return o | (sign >> 16);
+}
+
+static inline float _float16_to_float(uint16_t h)
+{
+    const uint32_t magic = 113u << 23;
+    const uint32_t shifted_exp = 0x7c00u << 13;
+    uint32_t o = (uint32_t(h) & 0x7fffu) << 13;
+    uint32_t exp = shifted_exp & o;
+    o += (127u - 15u) << 23;
+    if (exp == shifted_exp) {
+        // inf or NaN
+        o += (128u - 16u) << 23;
+    }
+    else if (exp == 0) {
+        // subnormal or zero, renormalise
+        o += 1u << 23;
+        o = _float_as_bits(_bits_as_float(o) - _bits_as_float(magic));
+    }
+    o |= (uint32_t(h) & 0x8000u) << 16;
+    return _bits_as_float(o);
+}
+
+/// bfloat16 is the upper half of the float, rounded to nearest even
+static inline uint16_t _float_to_bfloat16(float f)
+{
+    uint32_t u = _float_as_bits(f);
+    if ((u & 0x7fffffffu) > 0x7f800000u) return (u >> 16) | 0x0040u;
+    u += 0x7fffu + ((u >> 16) & 1u);
+    return u >> 16;
+}
+
+static inline float _bfloat16_to_float(uint16_t h)
+{
+    return _bits_as_float(uint32_t(h) << 16);
+}
+
+void hdf5_convert_float_to_float16(const float *in, uint16_t *out, size_t n)
+{
+    size_t i = 0;
+#if defined(__F16C__) && defined(__AVX__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)(out + i), h);
+    }
+#endif
+    for (; i < n; i++) out[i] = _float_to_float16(in[i]);
+}
+
+void hdf5_convert_float16_to_float(const uint16_t *in, float *out, size_t n)
+{
+    size_t i = 0;
+#if defined(__F16C__) && defined(__AVX__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+    }
+#endif
+    for (; i < n; i++) out[i] = _float16_to_float(in[i]);
+}
+
+void hdf5_convert_float_to_bfloat16(const float *in, uint16_t *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) out[i] = _float_to_bfloat16(in[i]);
+}
+
+void hdf5_convert_bfloat16_to_float(const uint16_t *in, float *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) out[i] = _bfloat16_to_float(in[i]);
+}
+
+/// Narrowing conversion done in place in the HDF5 conversion buffer. Each block
+/// is converted into a local buffer and copied back so the kernels never see
+/// aliased pointers. Going forward is safe as the output is smaller than the input.
+static void _convert_narrow(unsigned char *buf, size_t nelmts, size_t buf_stride,
+    void (*kernel)(const float *, uint16_t *, size_t))
+{
+    float in[HDF5CONVERSIONBLOCK];
+    uint16_t out[HDF5CONVERSIONBLOCK];
+    if (buf_stride == 0) {
+        for (size_t i = 0; i < nelmts; i += HDF5CONVERSIONBLOCK) {
+            size_t n = std::min(HDF5CONVERSIONBLOCK, nelmts - i);
+            std::memcpy(in, buf + i * sizeof(float), n * sizeof(float));
+            kernel(in, out, n);
+            std::memcpy(buf + i * sizeof(uint16_t), out, n * sizeof(uint16_t));
+        }
+    }
+    else {
+        for (size_t i = 0; i < nelmts; i++) {
+            std::memcpy(in, buf + i * buf_stride, sizeof(float));
+            kernel(in, out, 1);
+            std::memcpy(buf + i * buf_stride, out, sizeof(uint16_t));
+        }
+    }
+}
+
+/// Widening conversion done in place, going backwards so that unconverted
+/// input is never overwritten
+static void _convert_widen(unsigned char *buf, size_t nelmts, size_t buf_stride,
+    void (*kernel)(const uint16_t *, float *, size_t))
+{
+    uint16_t in[HDF5CONVERSIONBLOCK];
+    float out[HDF5CONVERSIONBLOCK];
+    if (buf_stride == 0) {
+        size_t end = nelmts;
+        while (end > 0) {
+            size_t n = std::min(HDF5CONVERSIONBLOCK, end);
+            size_t i = end - n;
+            std::memcpy(in, buf + i * sizeof(uint16_t), n * sizeof(uint16_t));
+            kernel(in, out, n);
+            std::memcpy(buf + i * sizeof(float), out, n * sizeof(float));
+            end = i;
+        }
+    }
+    else {
+        for (size_t i = 0; i < nelmts; i++) {
+            std::memcpy(in, buf + i * buf_stride, sizeof(uint16_t));
+            kernel(in, out, 1);
+            std::memcpy(buf + i * buf_stride, out, sizeof(float));
+        }
+    }
+}
+
+/// common handling of the conversion commands, returns true if data should be converted
+static bool _conv_command(H5T_cdata_t *cdata)
+{
+    if (cdata->command == H5T_CONV_INIT) cdata->need_bkg = H5T_BKG_NO;
+    return cdata->command == H5T_CONV_CONV;
+}
+
+static herr_t _conv_float_to_float16(hid_t src_id, hid_t dst_id, H5T_cdata_t *cdata,
+    size_t nelmts, size_t buf_stride, size_t bkg_stride, void *buf, void *bkg, hid_t dxpl)
+{
+    if (_conv_command(cdata)) _convert_narrow((unsigned char *)buf, nelmts, buf_stride, hdf5_convert_float_to_float16);
+    return 0;
+}
+static herr_t _conv_float16_to_float(hid_t src_id, hid_t dst_id, H5T_cdata_t *cdata,
+    size_t nelmts, size_t buf_stride, size_t bkg_stride, void *buf, void *bkg, hid_t dxpl)
+{
+    if (_conv_command(cdata)) _convert_widen((unsigned char *)buf, nelmts, buf_stride, hdf5_convert_float16_to_float);
+    return 0;
+}
+static herr_t _conv_float_to_bfloat16(hid_t src_id, hid_t dst_id, H5T_cdata_t *cdata,
+    size_t nelmts, size_t buf_stride, size_t bkg_stride, void *buf, void *bkg, hid_t dxpl)
+{
+    if (_conv_command(cdata)) _convert_narrow((unsigned char *)buf, nelmts, buf_stride, hdf5_convert_float_to_bfloat16);
+    return 0;
+}
+static herr_t _conv_bfloat16_to_float(hid_t src_id, hid_t dst_id, H5T_cdata_t *cdata,
+    size_t nelmts, size_t buf_stride, size_t bkg_stride, void *buf, void *bkg, hid_t dxpl)
+{
+    if (_conv_command(cdata)) _convert_widen((unsigned char *)buf, nelmts, buf_stride, hdf5_convert_bfloat16_to_float);
+    return 0;
+}
+
+/// build a 16 bit float type from the native float with the given layout
+static hid_t _make_float_type(size_t epos, size_t esize, size_t msize, size_t ebias)
+{
+    hid_t type_id = H5Tcopy(H5T_NATIVE_FLOAT);
+    H5Tset_fields(type_id, 15, epos, esize, 0, msize);
+    H5Tset_precision(type_id, 16);
+    H5Tset_size(type_id, 2);
+    H5Tset_ebias(type_id, ebias);
+    return type_id;
+}
+
+void hdf5_register_reduced_precision_types()
+{
+    // ids become invalid if the library is closed and reopened so check
+    // validity rather than just registering once
+    if (hdf5_float16_id >= 0 && H5Iis_valid(hdf5_float16_id) > 0) return;
+    hdf5_float16_id = _make_float_type(10, 5, 10, 15);
+    hdf5_bfloat16_id = _make_float_type(7, 8, 7, 127);
+    H5Tregister(H5T_PERS_HARD, "hdf5wrapper_float_to_float16", H5T_NATIVE_FLOAT, hdf5_float16_id, _conv_float_to_float16);
+    H5Tregister(H5T_PERS_HARD, "hdf5wrapper_float16_to_float", hdf5_float16_id, H5T_NATIVE_FLOAT, _conv_float16_to_float);
+    H5Tregister(H5T_PERS_HARD, "hdf5wrapper_float_to_bfloat16", H5T_NATIVE_FLOAT, hdf5_bfloat16_id, _conv_float_to_bfloat16);
+    H5Tregister(H5T_PERS_HARD, "hdf5wrapper_bfloat16_to_float", hdf5_bfloat16_id, H5T_NATIVE_FLOAT, _conv_bfloat16_to_float);
+}
+
+hid_t hdf5_type_float16()
+{
+    hdf5_register_reduced_precision_types();
+    return hdf5_float16_id;
+}
+
+hid_t hdf5_type_bfloat16()
+{
+    hdf5_register_reduced_precision_types();
+    return hdf5_bfloat16_id;
+}
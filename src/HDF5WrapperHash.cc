@@ -0,0 +1,89 @@
+#include "HDF5Wrapper.h"
+
+// Hashing. xxHash64 of a buffer, used to detect changed chunks of
+// checkpoints, identical datasets for deduplication and changed files in
+// the catalog. It is fast and well distributed but not cryptographic.
+
+static const uint64_t XXH_PRIME64_1 = 11400714785074694791ULL;
+static const uint64_t XXH_PRIME64_2 = 14029467366897019727ULL;
+static const uint64_t XXH_PRIME64_3 = 1609587929392839193ULL;
+static const uint64_t XXH_PRIME64_4 = 9650029242287828579ULL;
+static const uint64_t XXH_PRIME64_5 = 2870177450012600261ULL;
+
+static inline uint64_t _rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+static inline uint64_t _read64(const unsigned char *p)
+{
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+static inline uint32_t _read32(const unsigned char *p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+static inline uint64_t _xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = _rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+static inline uint64_t _xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= _xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t hdf5_hash64(const void *data, size_t len, uint64_t seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        const unsigned char *limit = end - 32;
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        do {
+            v1 = _xxh64_round(v1, _read64(p)); p += 8;
+            v2 = _xxh64_round(v2, _read64(p)); p += 8;
+            v3 = _xxh64_round(v3, _read64(p)); p += 8;
+            v4 = _xxh64_round(v4, _read64(p)); p += 8;
+        } while (p <= limit);
+        h = _rotl64(v1, 1) + _rotl64(v2, 7) + _rotl64(v3, 12) + _rotl64(v4, 18);
+        h = _xxh64_merge(h, v1);
+        h = _xxh64_merge(h, v2);
+        h = _xxh64_merge(h, v3);
+        h = _xxh64_merge(h, v4);
+    }
+    else {
+        h = seed + XXH_PRIME64_5;
+    }
+    h += (uint64_t)len;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= _xxh64_round(0, _read64(p));
+        h = _rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)_read32(p) * XXH_PRIME64_1;
+        h = _rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = _rotl64(h, 11) * XXH_PRIME64_1;
+    }
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,66 @@
+#include "HDF5Wrapper.h"
+
+// Chunk aligned redistribution for parallel compressed writes. When every
+// task writes the rows it happens to hold, the slices straddle chunk
+// boundaries and HDF5 has to exchange partial chunks and do read-modify-write
+// cycles in the collective write. Moving rows between tasks beforehand so
+// that each task holds whole chunks, contiguous along the first dimension,
+// lets each chunk be compressed and written by a single task.
+
+#ifdef USEPARALLELHDF
+const void *H5OutputFile::_redistribute_to_chunks(int rank, std::vector<hsize_t> &dims,
+    const void *data, hid_t memtype_id, H5StagingBuffer &buf)
+{
+    MPI_Comm comm = mpi_comm_write;
+    std::vector<unsigned long long> nrows_task(NProcsWrite);
+    unsigned long long nlocal = dims[0];
+    MPI_Allgather(&nlocal, 1, MPI_UNSIGNED_LONG_LONG, nrows_task.data(), 1, MPI_UNSIGNED_LONG_LONG, comm);
+
+    // the chunks are those the dataset will be created with
+    std::vector<hsize_t> dims_tot(dims), chunks;
+    dims_tot[0] = 0;
+    for (auto &n:nrows_task) dims_tot[0] += n;
+    _set_chunks(chunks, rank, dims.data(), dims_tot, true);
+    if (chunks.empty()) return data;
+
+    // task t is given the chunks [nchunks*t/NProcsWrite, nchunks*(t+1)/NProcsWrite)
+    hsize_t chunk_rows = chunks[0];
+    hsize_t nchunks = (dims_tot[0] + chunk_rows - 1) / chunk_rows;
+    std::vector<unsigned long long> source_start(NProcsWrite + 1, 0), target_start(NProcsWrite + 1, 0);
+    bool ialigned = true;
+    for (auto t=0;t<NProcsWrite;t++) {
+        source_start[t+1] = source_start[t] + nrows_task[t];
+        target_start[t+1] = std::min(dims_tot[0], (nchunks * (t + 1) / NProcsWrite) * chunk_rows);
+        if (source_start[t+1] != target_start[t+1]) ialigned = false;
+    }
+    if (ialigned) return data;
+
+    // rows sent to and received from every task, in units of rows
+    std::vector<int> send_counts(NProcsWrite), send_displs(NProcsWrite);
+    std::vector<int> recv_counts(NProcsWrite), recv_displs(NProcsWrite);
+    unsigned long long my_lo = source_start[ThisWriteTask], my_hi = source_start[ThisWriteTask+1];
+    unsigned long long new_lo = target_start[ThisWriteTask], new_hi = target_start[ThisWriteTask+1];
+    for (auto t=0;t<NProcsWrite;t++) {
+        unsigned long long lo = std::max(my_lo, target_start[t]), hi = std::min(my_hi, target_start[t+1]);
+        send_counts[t] = (hi > lo) ? hi - lo : 0;
+        send_displs[t] = (hi > lo) ? lo - my_lo : 0;
+        lo = std::max(new_lo, source_start[t]);
+        hi = std::min(new_hi, source_start[t+1]);
+        recv_counts[t] = (hi > lo) ? hi - lo : 0;
+        recv_displs[t] = (hi > lo) ? lo - new_lo : 0;
+    }
+
+    size_t row_bytes = H5Tget_size(memtype_id);
+    for (auto i=1;i<rank;i++) row_bytes *= dims[i];
+    MPI_Datatype row_type;
+    MPI_Type_contiguous(row_bytes, MPI_BYTE, &row_type);
+    MPI_Type_commit(&row_type);
+    buf = staging_pool.acquire((new_hi - new_lo) * row_bytes);
+    MPI_Alltoallv(data, send_counts.data(), send_displs.data(), row_type,
+        buf.data(), recv_counts.data(), recv_displs.data(), row_type, comm);
+    MPI_Type_free(&row_type);
+
+    dims[0] = new_hi - new_lo;
+    return buf.data();
+}
+#endif
@@ -0,0 +1,135 @@
+#include "HDF5Wrapper.h"
+
+// Single-writer/multiple-reader access. The writer opens the file with the
+// latest library version bounds, creates datasets with an unlimited first
+// dimension and then switches the file to SWMR writing, after which rows are
+// only appended and the file flushed so that readers opened with
+// H5F_ACC_SWMR_READ see a consistent file while it grows.
+
+hid_t H5OutputFile::_file_access_plist()
+{
+    if (!swmr_active) return H5P_DEFAULT;
+    hid_t fapl_id = H5Pcreate(H5P_FILE_ACCESS);
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST) < 0)
+        io_error("Failed to set the library version bounds for SWMR access");
+    return fapl_id;
+}
+
+void H5OutputFile::start_swmr_write()
+{
+    if (!swmr_active) io_error("Attempted to start SWMR writing without set_swmr()");
+#ifdef USEPARALLELHDF
+    // only the task that opened the file writes to it
+    if (parallel_access_id == -2) return;
+#endif
+    if (file_id < 0) io_error("Attempted to start SWMR writing of file which is not open!");
+    _flush_coalesced();
+    if (H5Fstart_swmr_write(file_id) < 0) io_error("Failed to start SWMR writing");
+    swmr_writing = true;
+    swmr_pending_bytes = 0;
+    swmr_last_flush = std::chrono::steady_clock::now();
+}
+
+void H5OutputFile::open_swmr_read(std::string filename)
+{
+    if (file_id >= 0) io_error("Attempted to open file when already open!");
+    file_id = H5Fopen(filename.c_str(), H5F_ACC_RDONLY | H5F_ACC_SWMR_READ, H5P_DEFAULT);
+    if (file_id < 0) io_error(std::string("Failed to open file for SWMR reading: ")+filename);
+#ifdef USEPARALLELHDF
+    parallel_access_id = -1;
+#endif
+}
+
+hsize_t H5OutputFile::refresh_dataset(const std::string &name)
+{
+    hid_t dset_id = H5Dopen(file_id, name.c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset: ")+name);
+    if (H5Drefresh(dset_id) < 0) io_error(std::string("Failed to refresh dataset: ")+name);
+    hid_t dspace_id = H5Dget_space(dset_id);
+    int rank = H5Sget_simple_extent_ndims(dspace_id);
+    hsize_t nrows = 0;
+    if (rank > 0) {
+        std::vector<hsize_t> dims(rank);
+        H5Sget_simple_extent_dims(dspace_id, dims.data(), NULL);
+        nrows = dims[0];
+    }
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+    return nrows;
+}
+
+void H5OutputFile::create_appendable_dataset(const std::string &name, int rank, const hsize_t *dims,
+    hid_t filetype_id, hsize_t chunk_rows)
+{
+#ifdef USEPARALLELHDF
+    if (parallel_access_id == -2) return;
+#endif
+    if (swmr_writing) io_error(std::string("Cannot create dataset once SWMR writing has started: ")+name);
+    if (rank < 1) io_error(std::string("Appendable dataset needs at least one dimension: ")+name);
+    std::vector<hsize_t> maxdims(dims, dims + rank), chunks(dims, dims + rank);
+    maxdims[0] = H5S_UNLIMITED;
+    chunks[0] = (chunk_rows > 0) ? chunk_rows : HDFOUTPUTCHUNKSIZE;
+    // chunks of a dimension of zero extent are not allowed
+    for (auto i=1;i<rank;i++) chunks[i] = std::max<hsize_t>(chunks[i], 1);
+
+    hid_t dspace_id = H5Screate_simple(rank, dims, maxdims.data());
+    hid_t dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dcpl_id, rank, chunks.data());
+    if (_use_delta_filter(name, filetype_id)) hdf5_set_delta_filter(dcpl_id);
+#ifdef USEHDFCOMPRESSION
+    H5Pset_deflate(dcpl_id, HDFDEFLATE);
+#endif
+    _create_parent_groups(name);
+    hid_t dset_id = H5Dcreate(file_id, name.c_str(), filetype_id, dspace_id,
+        H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+    H5Pclose(dcpl_id);
+    H5Sclose(dspace_id);
+    if (dset_id < 0) io_error(std::string("Failed to create appendable dataset: ")+name);
+    H5Dclose(dset_id);
+}
+
+void H5OutputFile::append_to_dataset(H5PathView name, hsize_t nrows, const void *data,
+    hid_t memtype_id)
+{
+#ifdef USEPARALLELHDF
+    if (parallel_access_id == -2) return;
+#endif
+    _flush_coalesced(name);
+    hid_t dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset: ")+name);
+    hid_t dspace_id = H5Dget_space(dset_id);
+    int rank = H5Sget_simple_extent_ndims(dspace_id);
+    std::vector<hsize_t> dims(rank), start(rank, 0);
+    H5Sget_simple_extent_dims(dspace_id, dims.data(), NULL);
+    H5Sclose(dspace_id);
+    if (nrows == 0) {
+        H5Dclose(dset_id);
+        return;
+    }
+
+    start[0] = dims[0];
+    dims[0] += nrows;
+    if (H5Dset_extent(dset_id, dims.data()) < 0) io_error(std::string("Failed to extend dataset: ")+name);
+    std::vector<hsize_t> count(dims);
+    count[0] = nrows;
+    hsize_t npoints = 1;
+    for (auto &c:count) npoints *= c;
+    dspace_id = H5Dget_space(dset_id);
+    H5Sselect_hyperslab(dspace_id, H5S_SELECT_SET, start.data(), NULL, count.data(), NULL);
+    hid_t memspace_id = H5Screate_simple(1, &npoints, NULL);
+    if (H5Dwrite(dset_id, memtype_id, memspace_id, dspace_id, H5P_DEFAULT, data) < 0)
+        io_error(std::string("Failed to append to dataset: ")+name);
+    H5Sclose(memspace_id);
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+    _swmr_flush_policy(npoints * H5Tget_size(memtype_id));
+}
+
+void H5OutputFile::_swmr_flush_policy(size_t nbytes)
+{
+    if (!swmr_writing) return;
+    swmr_pending_bytes += nbytes;
+    double age = std::chrono::duration<double>(std::chrono::steady_clock::now() - swmr_last_flush).count();
+    if ((swmr_flush_bytes > 0 && swmr_pending_bytes >= swmr_flush_bytes)
+        || (swmr_flush_seconds > 0 && age >= swmr_flush_seconds)) flush();
+}
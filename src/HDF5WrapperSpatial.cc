@@ -0,0 +1,257 @@
+#include "HDF5Wrapper.h"
+#ifdef USEOPENMP
+#include <omp.h>
+#endif
+
+// Space-filling-curve ordered particle output. Particles are sorted by the
+// Morton key of their position on a 2^21 grid per side so that particles
+// close in space are close in the file. Every dataset written to the group
+// with one row per particle is permuted into this order and the index
+// dataset group/spatial_index holds, for every cell of a coarser grid, the
+// offset of its first particle (one row of offsets per writing task as each
+// task sorts its own particles). A spatial query is then a few runs of rows.
+
+/// bits per dimension of the Morton keys used to sort
+static const unsigned int SPATIALKEYBITS = 21;
+
+/// spread the lower 21 bits of x so that there are two zero bits between each
+static inline uint64_t _morton_spread(uint64_t x)
+{
+    x &= 0x1fffffULL;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+static inline uint64_t _morton_key(uint64_t ix, uint64_t iy, uint64_t iz)
+{
+    return _morton_spread(ix) | (_morton_spread(iy) << 1) | (_morton_spread(iz) << 2);
+}
+
+/// cell of a coordinate on a grid of ncells per side, clamped to the grid
+static inline uint64_t _grid_cell(double x, double box_min, double scale, uint64_t ncells)
+{
+    double cell = (x - box_min) * scale;
+    if (!(cell > 0)) return 0;
+    if (cell >= ncells) return ncells - 1;
+    return (uint64_t)cell;
+}
+
+/// Morton keys of positions stored as n x 3
+struct _MortonKeyVisitor
+{
+    const void *pos;
+    long long n;
+    const double *box_min;
+    double scale;
+    uint64_t *keys;
+    template<typename T> void operator()(T dummy)
+    {
+        const T *p = (const T *)pos;
+        const uint64_t ncells = 1ULL << SPATIALKEYBITS;
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (long long i=0;i<n;i++) {
+            keys[i] = _morton_key(_grid_cell(p[3*i], box_min[0], scale, ncells),
+                _grid_cell(p[3*i+1], box_min[1], scale, ncells),
+                _grid_cell(p[3*i+2], box_min[2], scale, ncells));
+        }
+    }
+};
+
+/// Stable least significant digit radix sort of keys carrying along order,
+/// a byte per pass. The keys are cut into a fixed number of contiguous blocks,
+/// each counted and scattered in order by whichever thread takes it, so that
+/// the buckets are filled in the original order however many threads the
+/// parallel region gets. Passes where every key has the same byte are skipped.
+static void _radix_sort(std::vector<uint64_t> &keys, std::vector<unsigned long long> &order,
+    unsigned int nbits)
+{
+    long long n = keys.size();
+    std::vector<uint64_t> keys_tmp(n);
+    std::vector<unsigned long long> order_tmp(n);
+    int nblocks = 1;
+#ifdef USEOPENMP
+    nblocks = omp_get_max_threads();
+#endif
+    std::vector<long long> counts(256*nblocks);
+    for (unsigned int shift=0; shift<nbits; shift+=8) {
+        std::fill(counts.begin(), counts.end(), 0);
+        bool isorted = false;
+#ifdef USEOPENMP
+#pragma omp parallel
+#endif
+        {
+#ifdef USEOPENMP
+#pragma omp for schedule(static)
+#endif
+            for (int iblock=0;iblock<nblocks;iblock++) {
+                long long lo = n * iblock / nblocks, hi = n * (iblock + 1) / nblocks;
+                long long *c = &counts[256*iblock];
+                for (long long i=lo;i<hi;i++) c[(keys[i] >> shift) & 255]++;
+            }
+#ifdef USEOPENMP
+#pragma omp single
+#endif
+            {
+                long long offset = 0;
+                for (auto b=0;b<256;b++) {
+                    long long bucket_start = offset;
+                    for (auto t=0;t<nblocks;t++) {
+                        long long nb = counts[256*t+b];
+                        counts[256*t+b] = offset;
+                        offset += nb;
+                    }
+                    if (offset - bucket_start == n) isorted = true;
+                }
+            }
+            if (!isorted) {
+#ifdef USEOPENMP
+#pragma omp for schedule(static)
+#endif
+                for (int iblock=0;iblock<nblocks;iblock++) {
+                    long long lo = n * iblock / nblocks, hi = n * (iblock + 1) / nblocks;
+                    long long *c = &counts[256*iblock];
+                    for (long long i=lo;i<hi;i++) {
+                        long long j = c[(keys[i] >> shift) & 255]++;
+                        keys_tmp[j] = keys[i];
+                        order_tmp[j] = order[i];
+                    }
+                }
+            }
+        }
+        if (!isorted) {
+            keys.swap(keys_tmp);
+            order.swap(order_tmp);
+        }
+    }
+}
+
+void H5OutputFile::_begin_spatial_order(const std::string &group, hsize_t n, const void *pos,
+    hid_t memtype_id, const double *box_min, double box_size, unsigned int index_level,
+    bool flag_parallel, bool flag_collective)
+{
+    if (index_level > 7)
+        throw std::invalid_argument("Spatial index level must be at most 7");
+    end_spatial_order();
+
+    std::vector<uint64_t> keys(n);
+    _MortonKeyVisitor visitor = {pos, (long long)n, box_min,
+        (double)(1ULL << SPATIALKEYBITS) / box_size, keys.data()};
+    if (!hdf5_visit_native_type(memtype_id, visitor))
+        throw std::invalid_argument("Spatial order needs positions of a native numeric type");
+
+    std::vector<unsigned long long> order(n);
+    for (hsize_t i=0;i<n;i++) order[i] = i;
+    _radix_sort(keys, order, 3*SPATIALKEYBITS);
+
+    // offsets of the coarse cells, the particles of each coarse cell are
+    // contiguous as the coarse key is the leading bits of the fine key
+    unsigned long long row_offset = 0;
+#ifdef USEPARALLELHDF
+    if (flag_parallel) {
+        unsigned long long nlocal = n;
+        MPI_Exscan(&nlocal, &row_offset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, mpi_comm_write);
+        if (ThisWriteTask == 0) row_offset = 0;
+    }
+#endif
+    unsigned int key_shift = 3*(SPATIALKEYBITS - index_level);
+    hsize_t ncells = 1ULL << (3*index_level);
+    std::vector<unsigned long long> offsets(ncells + 1, 0);
+    for (hsize_t i=0;i<n;i++) offsets[(keys[i] >> key_shift) + 1]++;
+    offsets[0] = row_offset;
+    for (hsize_t i=0;i<ncells;i++) offsets[i+1] += offsets[i];
+
+    if (!_exists_path(group)) {
+        hid_t group_id = H5Gcreate(file_id, group.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        if (group_id < 0) io_error(std::string("Failed to create group: ")+group);
+        H5Gclose(group_id);
+    }
+    std::string index_name = group + "/spatial_index";
+    hsize_t index_dims[2] = {1, ncells + 1};
+    write_dataset_nd(index_name, 2, index_dims, offsets.data(), H5T_NATIVE_ULLONG, -1,
+        flag_parallel, true, true, flag_collective);
+    write_attribute(index_name, "box_min", std::vector<double>(box_min, box_min + 3));
+    write_attribute(index_name, "box_size", box_size);
+    write_attribute(index_name, "index_level", index_level);
+
+    spatial_group = group;
+    spatial_order.swap(order);
+}
+
+const void *H5OutputFile::_apply_spatial_order(H5PathView name, const void *data,
+    hid_t memtype_id, int rank, const hsize_t *dims, H5StagingBuffer &buf)
+{
+    if (spatial_group.size() == 0 || rank < 1 || dims[0] != spatial_order.size()) return data;
+    if (name.size() <= spatial_group.size() || std::memcmp(name.data(), spatial_group.data(), spatial_group.size()) != 0
+        || name[spatial_group.size()] != '/') return data;
+    size_t row_bytes = H5Tget_size(memtype_id);
+    for (auto i=1;i<rank;i++) row_bytes *= dims[i];
+    long long n = dims[0];
+    buf = staging_pool.acquire(n * row_bytes);
+    const char *in = (const char *)data;
+    char *out = (char *)buf.data();
+    const unsigned long long *order = spatial_order.data();
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (long long i=0;i<n;i++) std::memcpy(out + i * row_bytes, in + order[i] * row_bytes, row_bytes);
+    return buf.data();
+}
+
+void H5OutputFile::read_region(const std::string &group, const double *lo, const double *hi,
+    std::vector<hsize_t> &run_start, std::vector<hsize_t> &run_count)
+{
+    std::string index_name = group + "/spatial_index";
+    std::vector<double> box_min = read_attribute_v<double>(index_name+"/box_min");
+    double box_size = read_attribute<double>(index_name+"/box_size");
+    unsigned int index_level = read_attribute<unsigned int>(index_name+"/index_level");
+
+    hid_t dset_id = H5Dopen(file_id, index_name.c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open spatial index: ")+index_name);
+    hid_t dspace_id = H5Dget_space(dset_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(dspace_id, dims, NULL);
+    std::vector<unsigned long long> offsets(dims[0] * dims[1]);
+    if (H5Dread(dset_id, H5T_NATIVE_ULLONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, offsets.data()) < 0)
+        io_error(std::string("Failed to read spatial index: ")+index_name);
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+
+    // runs of rows of every cell overlapping the box in every task's block
+    uint64_t ncells = 1ULL << index_level;
+    double scale = ncells / box_size;
+    uint64_t cell_lo[3], cell_hi[3];
+    for (auto j=0;j<3;j++) {
+        cell_lo[j] = _grid_cell(lo[j], box_min[j], scale, ncells);
+        cell_hi[j] = _grid_cell(hi[j], box_min[j], scale, ncells);
+    }
+    std::vector<std::pair<hsize_t, hsize_t>> runs;
+    for (auto ix=cell_lo[0];ix<=cell_hi[0];ix++) {
+        for (auto iy=cell_lo[1];iy<=cell_hi[1];iy++) {
+            for (auto iz=cell_lo[2];iz<=cell_hi[2];iz++) {
+                uint64_t key = _morton_key(ix, iy, iz);
+                for (hsize_t iblock=0;iblock<dims[0];iblock++) {
+                    const unsigned long long *block = &offsets[iblock * dims[1]];
+                    if (block[key+1] > block[key]) runs.push_back(std::make_pair(block[key], block[key+1] - block[key]));
+                }
+            }
+        }
+    }
+    std::sort(runs.begin(), runs.end());
+    run_start.clear();
+    run_count.clear();
+    for (auto &run:runs) {
+        if (run_start.size() > 0 && run_start.back() + run_count.back() == run.first) {
+            run_count.back() += run.second;
+        }
+        else {
+            run_start.push_back(run.first);
+            run_count.push_back(run.second);
+        }
+    }
+}
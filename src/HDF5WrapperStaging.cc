@@ -0,0 +1,127 @@
+#include "HDF5Wrapper.h"
+#include <cstdlib>
+#include <new>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Staging buffers. Buffers are allocated aligned and kept once released so
+// that the next write needing a buffer of similar size reuses pages that are
+// already mapped. Idle buffers are freed when the memory held would exceed
+// the high-water mark.
+
+/// buffers of at least this size are aligned to, and sized in, huge pages
+static const size_t STAGINGHUGEPAGE = 2*1024*1024;
+/// alignment and size granularity of smaller buffers
+static const size_t STAGINGALIGN = 64;
+static const size_t STAGINGPAGE = 4096;
+/// default limit on the memory held by a pool
+static const size_t STAGINGHIGHWATERMARK = 1024*1024*1024;
+
+void H5StagingBuffer::release()
+{
+    if (pool != NULL && ptr != NULL) pool->_release(ptr);
+    pool = NULL;
+    ptr = NULL;
+    nbytes = 0;
+}
+
+H5StagingPool::H5StagingPool()
+{
+    high_water_mark = STAGINGHIGHWATERMARK;
+    stats = H5StagingStatistics();
+}
+
+H5StagingPool::H5StagingPool(const H5StagingPool &pool)
+{
+    high_water_mark = pool.high_water_mark;
+    stats = H5StagingStatistics();
+}
+
+H5StagingPool &H5StagingPool::operator=(const H5StagingPool &pool)
+{
+    if (this != &pool) high_water_mark = pool.high_water_mark;
+    return *this;
+}
+
+H5StagingPool::~H5StagingPool()
+{
+    // buffers still lent out are freed too, their handles must not outlive the pool
+    for (auto &buffer:buffers) std::free(buffer.ptr);
+}
+
+H5StagingBuffer H5StagingPool::acquire(size_t nbytes)
+{
+    stats.nrequests++;
+    if (nbytes == 0) return H5StagingBuffer();
+
+    // smallest idle buffer that is large enough
+    long long best = -1;
+    for (auto i=0;i<buffers.size();i++) {
+        if (buffers[i].inuse || buffers[i].nbytes < nbytes) continue;
+        if (best < 0 || buffers[i].nbytes < buffers[best].nbytes) best = i;
+    }
+    if (best >= 0) {
+        stats.nreuses++;
+        buffers[best].inuse = true;
+        stats.bytes_in_use += buffers[best].nbytes;
+        return H5StagingBuffer(this, buffers[best].ptr, nbytes);
+    }
+
+    size_t align = (nbytes >= STAGINGHUGEPAGE) ? STAGINGHUGEPAGE : STAGINGALIGN;
+    size_t granularity = (nbytes >= STAGINGHUGEPAGE) ? STAGINGHUGEPAGE : STAGINGPAGE;
+    size_t size = ((nbytes + granularity - 1) / granularity) * granularity;
+    // make room under the high-water mark, the new buffer is allocated regardless
+    _free_idle(high_water_mark > size ? high_water_mark - size : 0);
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, align, size) != 0) throw std::bad_alloc();
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (align == STAGINGHUGEPAGE) madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    Buffer buffer = {ptr, size, true};
+    buffers.push_back(buffer);
+    stats.nallocations++;
+    stats.nbuffers = buffers.size();
+    stats.bytes_held += size;
+    stats.bytes_in_use += size;
+    stats.peak_bytes_held = std::max(stats.peak_bytes_held, stats.bytes_held);
+    return H5StagingBuffer(this, ptr, nbytes);
+}
+
+void H5StagingPool::_release(void *ptr)
+{
+    for (auto &buffer:buffers) {
+        if (buffer.ptr != ptr) continue;
+        buffer.inuse = false;
+        stats.bytes_in_use -= buffer.nbytes;
+        break;
+    }
+    if (stats.bytes_held > high_water_mark) _free_idle(high_water_mark);
+}
+
+void H5StagingPool::_free_idle(size_t nbytes)
+{
+    while (stats.bytes_held > nbytes) {
+        long long largest = -1;
+        for (auto i=0;i<buffers.size();i++) {
+            if (buffers[i].inuse) continue;
+            if (largest < 0 || buffers[i].nbytes > buffers[largest].nbytes) largest = i;
+        }
+        if (largest < 0) break;
+        std::free(buffers[largest].ptr);
+        stats.bytes_held -= buffers[largest].nbytes;
+        buffers.erase(buffers.begin() + largest);
+    }
+    stats.nbuffers = buffers.size();
+}
+
+void H5StagingPool::set_high_water_mark(size_t nbytes)
+{
+    high_water_mark = nbytes;
+    _free_idle(high_water_mark);
+}
+
+void H5StagingPool::trim()
+{
+    _free_idle(0);
+}
@@ -0,0 +1,212 @@
+#include "HDF5Wrapper.h"
+#include <limits>
+
+// Statistics computed on the buffer passed to a write call. The summary
+// (min, max, sum, NaN count) and histogram are separate passes so that in
+// parallel the histogram range can be the global range of the data.
+
+template<typename T> static void _statistics_summary(const T *data, long long n,
+    H5DatasetStatistics &stats)
+{
+    double vmin = std::numeric_limits<double>::max();
+    double vmax = std::numeric_limits<double>::lowest();
+    double sum = 0;
+    unsigned long long nan_count = 0;
+#ifdef USEOPENMP
+#pragma omp parallel for simd reduction(min:vmin) reduction(max:vmax) reduction(+:sum,nan_count)
+#endif
+    for (long long i=0;i<n;i++) {
+        double v = data[i];
+        bool isnan = (v != v);
+        nan_count += isnan;
+        vmin = (isnan || v >= vmin) ? vmin : v;
+        vmax = (isnan || v <= vmax) ? vmax : v;
+        sum += isnan ? 0.0 : v;
+    }
+    stats.min = vmin;
+    stats.max = vmax;
+    stats.sum = sum;
+    stats.nan_count = nan_count;
+    stats.count = n;
+}
+
+template<typename T> static void _statistics_histogram(const T *data, long long n,
+    H5DatasetStatistics &stats)
+{
+    long long nbins = stats.histogram.size();
+    double lo = stats.histogram_min, hi = stats.histogram_max;
+    double scale = (hi > lo) ? nbins / (hi - lo) : 0.0;
+#ifdef USEOPENMP
+#pragma omp parallel
+#endif
+    {
+        std::vector<unsigned long long> local(nbins, 0);
+#ifdef USEOPENMP
+#pragma omp for nowait
+#endif
+        for (long long i=0;i<n;i++) {
+            double v = data[i];
+            if (v != v) continue;
+            long long bin = (long long)((v - lo) * scale);
+            bin = std::max(0LL, std::min(nbins - 1, bin));
+            local[bin]++;
+        }
+#ifdef USEOPENMP
+#pragma omp critical
+#endif
+        for (auto i=0;i<nbins;i++) stats.histogram[i] += local[i];
+    }
+}
+
+/// runs the summary (ihistogram false) or histogram pass for the native type
+struct _StatisticsVisitor
+{
+    bool ihistogram;
+    const void *data;
+    long long n;
+    H5DatasetStatistics *stats;
+    template<typename T> void operator()(T dummy)
+    {
+        if (ihistogram) _statistics_histogram((const T *)data, n, *stats);
+        else _statistics_summary((const T *)data, n, *stats);
+    }
+};
+
+/// add the histogram of earlier writes to that of this write, each earlier
+/// bin counted in the bin holding its centre when the ranges differ
+static void _rebin_histogram(const H5DatasetStatistics &old, H5DatasetStatistics &stats)
+{
+    long long nbins = stats.histogram.size();
+    double lo = stats.histogram_min, hi = stats.histogram_max;
+    double scale = (hi > lo) ? nbins / (hi - lo) : 0.0;
+    double old_width = (old.histogram_max - old.histogram_min) / nbins;
+    bool isame = (old.histogram_min == lo && old.histogram_max == hi);
+    for (auto i=0;i<nbins;i++) {
+        if (old.histogram[i] == 0) continue;
+        long long bin = i;
+        if (!isame) {
+            double centre = old.histogram_min + (i + 0.5) * old_width;
+            bin = (centre == centre) ? (long long)((centre - lo) * scale) : 0;
+            bin = std::max(0LL, std::min(nbins - 1, bin));
+        }
+        stats.histogram[bin] += old.histogram[i];
+    }
+}
+
+/// write an attribute, replacing it if it is already present
+template<typename T> static void _replace_attribute(hid_t obj_id, const char *name, const T *vals, hsize_t n)
+{
+    if (H5Aexists(obj_id, name) > 0) H5Adelete(obj_id, name);
+    hid_t dspace_id = (n == 1) ? H5Screate(H5S_SCALAR) : H5Screate_simple(1, &n, NULL);
+    hid_t attr_id = H5Acreate(obj_id, name, hdf5_type(T{}), dspace_id, H5P_DEFAULT, H5P_DEFAULT);
+    H5Awrite(attr_id, hdf5_type(T{}), vals);
+    H5Aclose(attr_id);
+    H5Sclose(dspace_id);
+}
+
+void H5OutputFile::_write_statistics(H5PathView name, const void *data, hid_t memtype_id,
+    int rank, const hsize_t *dims, bool flag_parallel, bool flag_accumulate)
+{
+    H5DatasetStatistics stats;
+    long long n = 1;
+    for (auto i=0;i<rank;i++) n *= dims[i];
+    _StatisticsVisitor visitor = {false, data, n, &stats};
+    if (!hdf5_visit_native_type(memtype_id, visitor)) return;
+
+#ifdef USEPARALLELHDF
+    if (flag_parallel) {
+        MPI_Comm comm = mpi_comm_write;
+        unsigned long long counts[2] = {stats.count, stats.nan_count};
+        MPI_Allreduce(MPI_IN_PLACE, &stats.min, 1, MPI_DOUBLE, MPI_MIN, comm);
+        MPI_Allreduce(MPI_IN_PLACE, &stats.max, 1, MPI_DOUBLE, MPI_MAX, comm);
+        MPI_Allreduce(MPI_IN_PLACE, &stats.sum, 1, MPI_DOUBLE, MPI_SUM, comm);
+        MPI_Allreduce(MPI_IN_PLACE, counts, 2, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+        stats.count = counts[0];
+        stats.nan_count = counts[1];
+    }
+#endif
+
+    // min and max of data with no values other than NaN are NaN
+    if (stats.nan_count == stats.count) stats.min = stats.max = std::numeric_limits<double>::quiet_NaN();
+
+    hid_t dset_id = H5Oopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Unable to open object to write statistics: ")+name);
+
+    // statistics of earlier writes to the same dataset
+    H5DatasetStatistics old;
+    bool iold = (flag_accumulate && H5Aexists(dset_id, "stats_count") > 0);
+    if (iold) old = read_statistics(name);
+    bool iold_histogram = iold && old.histogram.size() == statistics_nbins;
+
+    if (statistics_nbins > 0) {
+        stats.histogram.resize(statistics_nbins, 0);
+        if (statistics_histogram_max > statistics_histogram_min) {
+            stats.histogram_min = statistics_histogram_min;
+            stats.histogram_max = statistics_histogram_max;
+        }
+        else {
+            // the range of the data seen so far, the earlier histogram being rebinned to it
+            stats.histogram_min = stats.min;
+            stats.histogram_max = stats.max;
+            if (iold_histogram) {
+                stats.histogram_min = std::fmin(stats.histogram_min, old.histogram_min);
+                stats.histogram_max = std::fmax(stats.histogram_max, old.histogram_max);
+            }
+        }
+        visitor.ihistogram = true;
+        hdf5_visit_native_type(memtype_id, visitor);
+#ifdef USEPARALLELHDF
+        if (flag_parallel) {
+            MPI_Allreduce(MPI_IN_PLACE, stats.histogram.data(), statistics_nbins,
+                MPI_UNSIGNED_LONG_LONG, MPI_SUM, mpi_comm_write);
+        }
+#endif
+    }
+
+    if (iold) {
+        stats.min = std::fmin(stats.min, old.min);
+        stats.max = std::fmax(stats.max, old.max);
+        stats.sum += old.sum;
+        stats.count += old.count;
+        stats.nan_count += old.nan_count;
+        if (stats.histogram.size() > 0 && iold_histogram) {
+            _rebin_histogram(old, stats);
+        }
+        else if (stats.histogram.size() > 0 || old.histogram.size() > 0) {
+            // a histogram covering only some of the writes would be misleading
+            stats.histogram.clear();
+            if (H5Aexists(dset_id, "stats_histogram") > 0) H5Adelete(dset_id, "stats_histogram");
+            if (H5Aexists(dset_id, "stats_histogram_range") > 0) H5Adelete(dset_id, "stats_histogram_range");
+        }
+    }
+
+    _replace_attribute(dset_id, "stats_min", &stats.min, 1);
+    _replace_attribute(dset_id, "stats_max", &stats.max, 1);
+    _replace_attribute(dset_id, "stats_sum", &stats.sum, 1);
+    _replace_attribute(dset_id, "stats_count", &stats.count, 1);
+    _replace_attribute(dset_id, "stats_nan_count", &stats.nan_count, 1);
+    if (stats.histogram.size() > 0) {
+        double range[2] = {stats.histogram_min, stats.histogram_max};
+        _replace_attribute(dset_id, "stats_histogram", stats.histogram.data(), stats.histogram.size());
+        _replace_attribute(dset_id, "stats_histogram_range", range, 2);
+    }
+    H5Oclose(dset_id);
+}
+
+H5DatasetStatistics H5OutputFile::read_statistics(H5PathView name)
+{
+    H5DatasetStatistics stats;
+    stats.min = read_attribute<double>(name+"/stats_min");
+    stats.max = read_attribute<double>(name+"/stats_max");
+    stats.sum = read_attribute<double>(name+"/stats_sum");
+    stats.count = read_attribute<unsigned long long>(name+"/stats_count");
+    stats.nan_count = read_attribute<unsigned long long>(name+"/stats_nan_count");
+    stats.histogram_min = stats.histogram_max = 0;
+    if (exists_attribute(name.str(), "stats_histogram")) {
+        stats.histogram = read_attribute_v<unsigned long long>(name+"/stats_histogram");
+        std::vector<double> range = read_attribute_v<double>(name+"/stats_histogram_range");
+        stats.histogram_min = range[0];
+        stats.histogram_max = range[1];
+    }
+    return stats;
+}
@@ -0,0 +1,101 @@
+#include "HDF5Wrapper.h"
+#include <exception>
+
+// Streamed writes. The dataset is created once with its full extent and then
+// filled slab by slab, a slab being a run of rows along the first dimension
+// produced on demand, so that only one slab (two when double buffered) is
+// held in memory. Slabs are whole chunks where the dataset is chunked so
+// that every chunk is compressed and written once.
+
+/// target size of a slab when the number of rows is not given
+static const size_t STREAMSLABBYTES = 64*1024*1024;
+
+void H5OutputFile::write_dataset_streamed(H5PathView name, int rank, hsize_t *dims,
+    const H5SlabProducer &producer, hid_t memtype_id, hid_t filetype_id,
+    hsize_t slab_rows, bool flag_double_buffer)
+{
+    hid_t dset_id, dspace_id, memspace_id, prop_id;
+    bool iwrite;
+    if (memtype_id == -1) {
+        throw std::runtime_error("Streamed write called with no type info passed.");
+    }
+    if (filetype_id < 0) filetype_id = memtype_id;
+    _create_dataset_for_write(name, rank, dims, filetype_id,
+        dset_id, dspace_id, memspace_id, prop_id, iwrite,
+        false, true, true, false);
+
+    size_t row_bytes = H5Tget_size(memtype_id);
+    for (auto i=1;i<rank;i++) row_bytes *= dims[i];
+    hsize_t chunk_rows = 1;
+    hid_t dcpl_id = H5Dget_create_plist(dset_id);
+    if (H5Pget_layout(dcpl_id) == H5D_CHUNKED) {
+        std::vector<hsize_t> chunks(rank);
+        H5Pget_chunk(dcpl_id, rank, chunks.data());
+        chunk_rows = chunks[0];
+    }
+    H5Pclose(dcpl_id);
+    if (slab_rows == 0) slab_rows = std::max<size_t>(STREAMSLABBYTES / std::max<size_t>(row_bytes, 1), 1);
+    slab_rows = std::max<hsize_t>(slab_rows / chunk_rows, 1) * chunk_rows;
+    slab_rows = std::min(slab_rows, dims[0]);
+
+    bool idouble = false;
+#ifdef USEOPENMP
+    idouble = flag_double_buffer;
+#endif
+    H5StagingBuffer bufs[2];
+    if (iwrite) {
+        bufs[0] = staging_pool.acquire(slab_rows * row_bytes);
+        if (idouble) bufs[1] = staging_pool.acquire(slab_rows * row_bytes);
+    }
+    std::vector<hsize_t> start(rank, 0), count(dims, dims + rank);
+
+    // the next slab is produced while the current one is written
+    hsize_t row = 0;
+    if (iwrite) producer(0, std::min(slab_rows, dims[0]), bufs[0].data());
+    for (auto islab=0; row < dims[0]; islab++) {
+        hsize_t nrows = std::min(slab_rows, dims[0] - row);
+        hsize_t next_row = row + nrows;
+        hsize_t next_nrows = std::min(slab_rows, dims[0] - next_row);
+        H5StagingBuffer &buf = bufs[idouble ? islab % 2 : 0];
+        H5StagingBuffer &next_buf = bufs[idouble ? (islab + 1) % 2 : 0];
+        herr_t ret = 0;
+        std::exception_ptr producer_error;
+#ifdef USEOPENMP
+#pragma omp parallel sections num_threads(2) if(idouble && next_nrows > 0)
+#endif
+        {
+#ifdef USEOPENMP
+#pragma omp section
+#endif
+            {
+                hsize_t npoints = nrows * (row_bytes / H5Tget_size(memtype_id));
+                start[0] = row;
+                count[0] = nrows;
+                H5Sselect_hyperslab(dspace_id, H5S_SELECT_SET, start.data(), NULL, count.data(), NULL);
+                hid_t slab_id = H5Screate_simple(1, &npoints, NULL);
+                ret = H5Dwrite(dset_id, memtype_id, slab_id, dspace_id, prop_id, buf.data());
+                H5Sclose(slab_id);
+            }
+#ifdef USEOPENMP
+#pragma omp section
+#endif
+            if (idouble && next_nrows > 0) {
+                try {
+                    producer(next_row, next_nrows, next_buf.data());
+                }
+                catch (...) {
+                    producer_error = std::current_exception();
+                }
+            }
+        }
+        if (ret < 0) io_error(std::string("Failed to write slab of dataset: ")+name);
+        if (producer_error) std::rethrow_exception(producer_error);
+        if (write_statistics) {
+            hsize_t npoints = nrows * (row_bytes / H5Tget_size(memtype_id));
+            _write_statistics(name, buf.data(), memtype_id, 1, &npoints, false, islab > 0);
+        }
+        if (!idouble && next_nrows > 0) producer(next_row, next_nrows, next_buf.data());
+        row = next_row;
+    }
+    _close_dataset_for_write(dset_id, dspace_id, memspace_id, prop_id, false, true);
+}
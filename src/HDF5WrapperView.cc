@@ -0,0 +1,52 @@
+#include "HDF5Wrapper.h"
+
+// Opening datasets for DatasetView. The view reads whole chunks and keeps the
+// decoded chunks itself, so HDF5's raw chunk cache only has to hold the chunk
+// being read; a larger cache would just hold a second copy of the data.
+
+/// bytes read at a time from datasets that are not chunked
+static const size_t DATASETVIEWBLOCKBYTES = 1024*1024;
+/// slots of the chunk cache hash table, a prime as recommended by HDF5
+static const size_t DATASETVIEWCACHESLOTS = 521;
+
+hid_t H5OutputFile::_open_dataset_view(const std::string &name, size_t elsize,
+    std::vector<hsize_t> &block_dims)
+{
+    _flush_coalesced(name);
+    hid_t dset_id = H5Dopen(file_id, name.c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset for view: ")+name);
+    hid_t dspace_id = H5Dget_space(dset_id);
+    int rank = H5Sget_simple_extent_ndims(dspace_id);
+    std::vector<hsize_t> dims(rank);
+    H5Sget_simple_extent_dims(dspace_id, dims.data(), NULL);
+    H5Sclose(dspace_id);
+
+    block_dims.resize(rank);
+    hid_t dcpl_id = H5Dget_create_plist(dset_id);
+    bool ichunked = (H5Pget_layout(dcpl_id) == H5D_CHUNKED);
+    if (ichunked) {
+        H5Pget_chunk(dcpl_id, rank, block_dims.data());
+    }
+    else if (rank > 0) {
+        // rows along the first dimension up to the block size
+        size_t row_bytes = elsize;
+        for (auto i=1;i<rank;i++) {
+            block_dims[i] = std::max<hsize_t>(dims[i], 1);
+            row_bytes *= block_dims[i];
+        }
+        block_dims[0] = std::max<hsize_t>(std::min<hsize_t>(dims[0], DATASETVIEWBLOCKBYTES / row_bytes), 1);
+    }
+    H5Pclose(dcpl_id);
+    if (!ichunked) return dset_id;
+
+    // reopen with a chunk cache holding one chunk, fully read chunks evicted first
+    size_t chunk_bytes = elsize;
+    for (auto &d:block_dims) chunk_bytes *= d;
+    H5Dclose(dset_id);
+    hid_t dapl_id = H5Pcreate(H5P_DATASET_ACCESS);
+    H5Pset_chunk_cache(dapl_id, DATASETVIEWCACHESLOTS, chunk_bytes, 1.0);
+    dset_id = H5Dopen(file_id, name.c_str(), dapl_id);
+    H5Pclose(dapl_id);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset for view: ")+name);
+    return dset_id;
+}
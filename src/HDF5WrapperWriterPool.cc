@@ -0,0 +1,309 @@
+#include "HDF5Wrapper.h"
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <cerrno>
+
+// Writer pool. Each worker is a forked process with its own H5OutputFile,
+// a socket to the parent and a shared memory region split into slots. A dataset is sent as a begin message (name, encoded types and
+// dims) followed by data messages, each naming a slot holding the next piece
+// of the dataset. The worker streams the pieces into the dataset and returns
+// every slot once copied so the parent can refill it, and acknowledges
+// every dataset once written so the parent knows how busy it is.
+
+/// acknowledgement of a written dataset rather than of a copied slot
+static const int POOLDATASETDONE = -1;
+
+enum {POOLBEGIN, POOLDATA, POOLCLOSE};
+
+/// fixed part of a message, a begin message is followed by the name and the
+/// encoded memory and file types
+struct _PoolMessage
+{
+    int type;
+    int slot;
+    size_t nbytes;
+    int rank;
+    hsize_t dims[H5S_MAX_RANK];
+    size_t name_len, memtype_len, filetype_len;
+};
+
+static void _pool_write(int fd, const void *buf, size_t nbytes)
+{
+    const char *p = (const char *)buf;
+    while (nbytes > 0) {
+#ifdef MSG_NOSIGNAL
+        // a worker that died is reported as an error rather than by SIGPIPE
+        ssize_t n = send(fd, p, nbytes, MSG_NOSIGNAL);
+#else
+        ssize_t n = ::write(fd, p, nbytes);
+#endif
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw std::runtime_error("Writer pool lost a worker");
+        p += n;
+        nbytes -= n;
+    }
+}
+
+/// read exactly nbytes, returning false at the end of the stream
+static bool _pool_read(int fd, void *buf, size_t nbytes)
+{
+    char *p = (char *)buf;
+    while (nbytes > 0) {
+        ssize_t n = ::read(fd, p, nbytes);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        nbytes -= n;
+    }
+    return true;
+}
+
+static std::vector<unsigned char> _pool_encode_type(hid_t type_id)
+{
+    size_t nalloc = 0;
+    H5Tencode(type_id, NULL, &nalloc);
+    std::vector<unsigned char> buf(nalloc);
+    H5Tencode(type_id, buf.data(), &nalloc);
+    return buf;
+}
+
+H5WriterPool::H5WriterPool(const std::string &_filename, int nworkers,
+    size_t _slot_bytes, int _nslots)
+{
+    filename = _filename;
+    slot_bytes = _slot_bytes;
+    nslots = std::max(_nslots, 1);
+    next_worker = 0;
+    iopen = true;
+    if (nworkers < 1) throw std::invalid_argument("Writer pool needs at least one worker");
+    for (auto i=0;i<nworkers;i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+            throw std::runtime_error("Failed to create socket of writer pool");
+        void *shm = mmap(NULL, slot_bytes * nslots, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shm == MAP_FAILED) throw std::runtime_error("Failed to map shared memory of writer pool");
+        pid_t pid = fork();
+        if (pid < 0) throw std::runtime_error("Failed to fork writer pool worker");
+        if (pid == 0) {
+            ::close(fds[0]);
+            // the sockets of workers forked earlier belong to the parent only
+            for (auto &worker:workers) ::close(worker.fd);
+            _run_worker(i, fds[1], (char *)shm);
+        }
+        ::close(fds[1]);
+        Worker worker;
+        worker.pid = pid;
+        worker.fd = fds[0];
+        worker.shm = (char *)shm;
+        worker.slot_free.assign(nslots, true);
+        worker.nfree = nslots;
+        worker.pending_bytes = 0;
+        workers.push_back(worker);
+    }
+}
+
+H5WriterPool::~H5WriterPool()
+{
+    if (!iopen) return;
+    // a destructor must not throw, possibly while unwinding from a failed
+    // write, so failures are only reported here; call close to handle them
+    try {
+        close();
+    }
+    catch (std::exception &e) {
+        std::cerr << "Writer pool " << filename << ": " << e.what() << std::endl;
+    }
+}
+
+std::string H5WriterPool::worker_filename(int iworker) const
+{
+    std::string::size_type slash = filename.find_last_of('/');
+    std::string::size_type dot = filename.find_last_of('.');
+    std::string suffix = ".worker" + std::to_string(iworker);
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return filename + suffix;
+    return filename.substr(0, dot) + suffix + filename.substr(dot);
+}
+
+bool H5WriterPool::_read_ack(Worker &worker, bool iwait)
+{
+    if (!iwait) {
+        struct pollfd fd = {worker.fd, POLLIN, 0};
+        if (poll(&fd, 1, 0) <= 0 || !(fd.revents & (POLLIN | POLLHUP))) return false;
+    }
+    int ack;
+    if (!_pool_read(worker.fd, &ack, sizeof(ack)))
+        throw std::runtime_error("Writer pool worker failed, see its error output");
+    if (ack == POOLDATASETDONE) {
+        worker.pending_bytes -= worker.pending.front();
+        worker.pending.pop_front();
+    }
+    else {
+        worker.slot_free[ack] = true;
+        worker.nfree++;
+    }
+    return true;
+}
+
+int H5WriterPool::_acquire_slot(Worker &worker)
+{
+    while (worker.nfree == 0) _read_ack(worker, true);
+    for (auto i=0;i<nslots;i++) {
+        if (!worker.slot_free[i]) continue;
+        worker.slot_free[i] = false;
+        worker.nfree--;
+        return i;
+    }
+    return -1;
+}
+
+void H5WriterPool::write_dataset_nd(H5PathView name, int rank, const hsize_t *dims,
+    const void *data, hid_t memtype_id, hid_t filetype_id)
+{
+    if (!iopen) throw std::runtime_error("Writer pool already closed");
+    if (rank < 1 || rank > H5S_MAX_RANK) throw std::invalid_argument("Unsupported rank of dataset handed to writer pool");
+    if (filetype_id < 0) filetype_id = memtype_id;
+
+    // the worker with the fewest bytes still to write
+    int iworker = next_worker;
+    for (auto j=0;j<workers.size();j++) {
+        int i = (next_worker + j) % workers.size();
+        while (_read_ack(workers[i], false));
+        if (workers[i].pending_bytes < workers[iworker].pending_bytes) iworker = i;
+    }
+    next_worker = (iworker + 1) % workers.size();
+    Worker &worker = workers[iworker];
+
+    std::vector<unsigned char> memtype = _pool_encode_type(memtype_id);
+    std::vector<unsigned char> filetype = _pool_encode_type(filetype_id);
+    _PoolMessage message = {};
+    message.type = POOLBEGIN;
+    message.rank = rank;
+    for (auto i=0;i<rank;i++) message.dims[i] = dims[i];
+    message.name_len = name.size();
+    message.memtype_len = memtype.size();
+    message.filetype_len = filetype.size();
+    _pool_write(worker.fd, &message, sizeof(message));
+    _pool_write(worker.fd, name.data(), name.size());
+    _pool_write(worker.fd, memtype.data(), memtype.size());
+    _pool_write(worker.fd, filetype.data(), filetype.size());
+
+    size_t nbytes = H5Tget_size(memtype_id);
+    for (auto i=0;i<rank;i++) nbytes *= dims[i];
+    worker.pending.push_back(nbytes);
+    worker.pending_bytes += nbytes;
+    const char *p = (const char *)data;
+    for (size_t offset=0; offset<nbytes; offset+=slot_bytes) {
+        int slot = _acquire_slot(worker);
+        message.type = POOLDATA;
+        message.slot = slot;
+        message.nbytes = std::min(slot_bytes, nbytes - offset);
+        std::memcpy(worker.shm + slot * slot_bytes, p + offset, message.nbytes);
+        _pool_write(worker.fd, &message, sizeof(message));
+    }
+    datasets.push_back(std::make_pair(name.str(), iworker));
+}
+
+void H5WriterPool::close()
+{
+    if (!iopen) return;
+    iopen = false;
+    bool ifailed = false;
+    for (auto &worker:workers) {
+        _PoolMessage message = {};
+        message.type = POOLCLOSE;
+        try {
+            _pool_write(worker.fd, &message, sizeof(message));
+        }
+        catch (std::runtime_error &e) {
+            ifailed = true;
+        }
+    }
+    for (auto &worker:workers) {
+        int status;
+        waitpid(worker.pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ifailed = true;
+        ::close(worker.fd);
+        munmap(worker.shm, slot_bytes * nslots);
+    }
+    if (ifailed) throw std::runtime_error("Writer pool worker failed, output incomplete");
+
+    // the combined file links to the datasets in the files of the workers,
+    // named relative to it as they sit in the same directory
+    hid_t file_id = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (file_id < 0) throw std::runtime_error("Failed to create combined file of writer pool: " + filename);
+    hid_t lcpl_id = H5Pcreate(H5P_LINK_CREATE);
+    H5Pset_create_intermediate_group(lcpl_id, 1);
+    for (auto &dataset:datasets) {
+        std::string target = worker_filename(dataset.second);
+        std::string::size_type slash = target.find_last_of('/');
+        if (slash != std::string::npos) target = target.substr(slash + 1);
+        if (H5Lcreate_external(target.c_str(), dataset.first.c_str(), file_id,
+            dataset.first.c_str(), lcpl_id, H5P_DEFAULT) < 0) {
+            H5Pclose(lcpl_id);
+            H5Fclose(file_id);
+            throw std::runtime_error("Failed to link dataset of writer pool: " + dataset.first);
+        }
+    }
+    H5Pclose(lcpl_id);
+    H5Fclose(file_id);
+}
+
+void H5WriterPool::_run_worker(int iworker, int fd, char *shm)
+{
+    int status = 0;
+    try {
+        H5OutputFile out;
+        out.create(worker_filename(iworker));
+        _PoolMessage message;
+        while (_pool_read(fd, &message, sizeof(message)) && message.type == POOLBEGIN) {
+            std::string name(message.name_len, ' ');
+            std::vector<unsigned char> memtype(message.memtype_len), filetype(message.filetype_len);
+            if (!_pool_read(fd, &name[0], name.size())
+                || !_pool_read(fd, memtype.data(), memtype.size())
+                || !_pool_read(fd, filetype.data(), filetype.size())) break;
+            hid_t memtype_id = H5Tdecode(memtype.data());
+            hid_t filetype_id = H5Tdecode(filetype.data());
+
+            // the data messages are consumed as the slabs of a streamed write
+            _PoolMessage piece;
+            size_t piece_used = 0;
+            piece.nbytes = 0;
+            size_t row_bytes = H5Tget_size(memtype_id);
+            for (auto i=1;i<message.rank;i++) row_bytes *= message.dims[i];
+            H5SlabProducer producer = [&](hsize_t row_start, hsize_t nrows, void *buf)
+            {
+                size_t need = nrows * row_bytes;
+                char *out_buf = (char *)buf;
+                while (need > 0) {
+                    if (piece_used == piece.nbytes) {
+                        if (!_pool_read(fd, &piece, sizeof(piece)) || piece.type != POOLDATA)
+                            throw std::runtime_error("Writer pool worker expected data");
+                        piece_used = 0;
+                    }
+                    size_t n = std::min(need, piece.nbytes - piece_used);
+                    std::memcpy(out_buf, shm + piece.slot * slot_bytes + piece_used, n);
+                    out_buf += n;
+                    piece_used += n;
+                    need -= n;
+                    if (piece_used == piece.nbytes) _pool_write(fd, &piece.slot, sizeof(piece.slot));
+                }
+            };
+            out._create_parent_groups(name);
+            out.write_dataset_streamed(name, message.rank, message.dims, producer,
+                memtype_id, filetype_id, 0, false);
+            H5Tclose(memtype_id);
+            H5Tclose(filetype_id);
+            _pool_write(fd, &POOLDATASETDONE, sizeof(POOLDATASETDONE));
+        }
+        out.close();
+    }
+    catch (std::exception &e) {
+        std::cerr << "Writer pool worker " << iworker << ": " << e.what() << std::endl;
+        status = 1;
+    }
+    // leave without running the exit handlers of the parent's libraries
+    _exit(status);
+}
@@ -0,0 +1,187 @@
+#include "HDF5Wrapper.h"
+#include <limits>
+
+// Zone maps. For selected datasets the min and max of every zone, a chunk
+// of rows along the first dimension, are stored in the companion dataset
+// name_zonemap (nzones x 2) with the zone size as an attribute. Range
+// queries then only read the zones that can hold matching values.
+
+/// min and max of the zones covered by the rows local to this task
+struct _ZoneMapVisitor
+{
+    const void *data;
+    hsize_t nrows, row_size, row_offset, zone_size;
+    double *zone_min, *zone_max;
+    template<typename T> void operator()(T dummy)
+    {
+        const T *values = (const T *)data;
+        if (nrows == 0) return;
+        long long first_zone = row_offset / zone_size;
+        long long last_zone = (row_offset + nrows - 1) / zone_size;
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (long long izone=first_zone; izone<=last_zone; izone++) {
+            hsize_t row_start = std::max((hsize_t)izone * zone_size, row_offset) - row_offset;
+            hsize_t row_end = std::min((hsize_t)(izone + 1) * zone_size, row_offset + nrows) - row_offset;
+            double vmin = zone_min[izone], vmax = zone_max[izone];
+            for (hsize_t i=row_start*row_size; i<row_end*row_size; i++) {
+                double v = values[i];
+                vmin = (v < vmin) ? v : vmin;
+                vmax = (v > vmax) ? v : vmax;
+            }
+            zone_min[izone] = vmin;
+            zone_max[izone] = vmax;
+        }
+    }
+};
+
+void H5OutputFile::_write_zone_map(H5PathView name, const void *data, hid_t memtype_id,
+    int rank, const hsize_t *dims, bool flag_parallel)
+{
+    if (std::find(zone_map_datasets.begin(), zone_map_datasets.end(), name) == zone_map_datasets.end()) return;
+    hid_t dset_id, dspace_id, memspace_id, prop_id;
+    bool iwrite;
+    hsize_t nrows = dims[0], nrows_tot = dims[0], row_offset = 0, row_size = 1;
+    for (auto i=1;i<rank;i++) row_size *= dims[i];
+#ifdef USEPARALLELHDF
+    // zones are global so need the offset of the local rows
+    if (flag_parallel) {
+        MPI_Comm comm = mpi_comm_write;
+        unsigned long long nlocal = nrows, noffset = 0, ntot = 0;
+        MPI_Exscan(&nlocal, &noffset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+        MPI_Allreduce(&nlocal, &ntot, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+        row_offset = (ThisWriteTask == 0) ? 0 : noffset;
+        nrows_tot = ntot;
+    }
+#endif
+
+    // zones follow the chunks of the dataset if it is chunked
+    hsize_t zone_size = HDFOUTPUTCHUNKSIZE;
+    dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset for zone map: ")+name);
+    prop_id = H5Dget_create_plist(dset_id);
+    if (H5Pget_layout(prop_id) == H5D_CHUNKED) {
+        std::vector<hsize_t> chunks(rank);
+        H5Pget_chunk(prop_id, rank, chunks.data());
+        zone_size = chunks[0];
+    }
+    H5Pclose(prop_id);
+    H5Dclose(dset_id);
+
+    hsize_t nzones = (nrows_tot + zone_size - 1) / zone_size;
+    std::vector<double> zone_min(nzones, std::numeric_limits<double>::max());
+    std::vector<double> zone_max(nzones, std::numeric_limits<double>::lowest());
+    _ZoneMapVisitor visitor = {data, nrows, row_size, row_offset, zone_size, zone_min.data(), zone_max.data()};
+    if (!hdf5_visit_native_type(memtype_id, visitor)) return;
+#ifdef USEPARALLELHDF
+    if (flag_parallel) {
+        MPI_Allreduce(MPI_IN_PLACE, zone_min.data(), nzones, MPI_DOUBLE, MPI_MIN, mpi_comm_write);
+        MPI_Allreduce(MPI_IN_PLACE, zone_max.data(), nzones, MPI_DOUBLE, MPI_MAX, mpi_comm_write);
+    }
+#endif
+    std::vector<double> zone_map(2*nzones);
+    for (hsize_t i=0;i<nzones;i++) {
+        zone_map[2*i] = zone_min[i];
+        zone_map[2*i+1] = zone_max[i];
+    }
+
+    // every task holds the full zone map so it is written without a parallel hyperslab
+    std::string zone_name = name + "_zonemap";
+    hsize_t zone_dims[2] = {nzones, 2};
+    _create_dataset_for_write(zone_name, 2, zone_dims, H5T_NATIVE_DOUBLE,
+        dset_id, dspace_id, memspace_id, prop_id, iwrite,
+        false, false, false, false);
+    if (iwrite) {
+        if (H5Dwrite(dset_id, H5T_NATIVE_DOUBLE, memspace_id, dspace_id, prop_id, zone_map.data()) < 0)
+            io_error(std::string("Failed to write zone map: ")+zone_name);
+    }
+    _close_dataset_for_write(dset_id, dspace_id, memspace_id, prop_id, false, false);
+    write_attribute(zone_name, "zone_size", (unsigned long long)zone_size);
+}
+
+void H5OutputFile::_read_zones(H5PathView name, double lo, double hi, hid_t memtype_id,
+    std::vector<char> &buf, std::vector<hsize_t> &run_start, std::vector<hsize_t> &run_count,
+    hsize_t &row_size)
+{
+    std::string zone_name = name + "_zonemap";
+    hsize_t nrows;
+
+    hid_t dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset: ")+name);
+    hid_t dspace_id = H5Dget_space(dset_id);
+    int rank = H5Sget_simple_extent_ndims(dspace_id);
+    std::vector<hsize_t> dims(rank);
+    H5Sget_simple_extent_dims(dspace_id, dims.data(), NULL);
+    nrows = dims[0];
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+
+    run_start.clear();
+    run_count.clear();
+    if (_exists_path(zone_name)) {
+        hsize_t zone_size = read_attribute<unsigned long long>(zone_name+"/zone_size");
+        hsize_t nzones = (nrows + zone_size - 1) / zone_size;
+        std::vector<double> zone_map(2*nzones);
+        if (nzones > 0) read_from_dataset_nd(zone_name, zone_map.data(), {}, {});
+        // merge neighbouring zones that overlap the predicate into runs of rows
+        for (hsize_t izone=0;izone<nzones;izone++) {
+            if (zone_map[2*izone+1] < lo || zone_map[2*izone] > hi) continue;
+            hsize_t row = izone * zone_size;
+            hsize_t nzone_rows = std::min(zone_size, nrows - row);
+            if (run_start.size() > 0 && run_start.back() + run_count.back() == row) {
+                run_count.back() += nzone_rows;
+            }
+            else {
+                run_start.push_back(row);
+                run_count.push_back(nzone_rows);
+            }
+        }
+    }
+    else if (nrows > 0) {
+        run_start.push_back(0);
+        run_count.push_back(nrows);
+    }
+    _read_row_runs(name, memtype_id, run_start, run_count, buf, row_size);
+}
+
+void H5OutputFile::_read_row_runs(H5PathView name, hid_t memtype_id,
+    const std::vector<hsize_t> &run_start, const std::vector<hsize_t> &run_count,
+    std::vector<char> &buf, hsize_t &row_size)
+{
+    _flush_coalesced(name);
+    hid_t dset_id, dspace_id, memspace_id;
+    hsize_t nrows_read = 0;
+
+    dset_id = H5Dopen(file_id, H5PathBuffer(name).c_str(), H5P_DEFAULT);
+    if (dset_id < 0) io_error(std::string("Failed to open dataset: ")+name);
+    dspace_id = H5Dget_space(dset_id);
+    int rank = H5Sget_simple_extent_ndims(dspace_id);
+    std::vector<hsize_t> dims(rank), start(rank, 0), count(rank);
+    H5Sget_simple_extent_dims(dspace_id, dims.data(), NULL);
+    row_size = 1;
+    for (auto i=1;i<rank;i++) {
+        row_size *= dims[i];
+        count[i] = dims[i];
+    }
+
+    // read all runs with a single read of the union of their hyperslabs
+    for (auto &n:run_count) nrows_read += n;
+    buf.resize(nrows_read * row_size * H5Tget_size(memtype_id));
+    if (nrows_read > 0) {
+        H5Sselect_none(dspace_id);
+        for (size_t irun=0;irun<run_start.size();irun++) {
+            if (run_count[irun] == 0) continue;
+            start[0] = run_start[irun];
+            count[0] = run_count[irun];
+            H5Sselect_hyperslab(dspace_id, H5S_SELECT_OR, start.data(), NULL, count.data(), NULL);
+        }
+        hsize_t nread = nrows_read * row_size;
+        memspace_id = H5Screate_simple(1, &nread, NULL);
+        if (H5Dread(dset_id, memtype_id, memspace_id, dspace_id, H5P_DEFAULT, buf.data()) < 0)
+            io_error(std::string("Failed to read rows of dataset: ")+name);
+        H5Sclose(memspace_id);
+    }
+    H5Sclose(dspace_id);
+    H5Dclose(dset_id);
+}
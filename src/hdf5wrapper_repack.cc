@@ -0,0 +1,609 @@
+#include "HDF5Wrapper.h"
+#include <atomic>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// hdf5wrapper_repack: copy a file to a new one with a new chunking and
+// compression policy. The source is walked once to plan the copy: datasets
+// are cut along their first dimension into pieces of whole chunks and the
+// pieces gathered into units of about the same size. Worker processes take
+// units in turn, read and decode the pieces and write them compressed with
+// the new policy to a temporary file per unit, so decoding and encoding run
+// in parallel. Meanwhile this process builds the groups, links, attributes
+// and empty datasets of the output and, as each unit is finished, copies its
+// already compressed chunks into the output with H5Dread_chunk and
+// H5Dwrite_chunk, the chunks lining up as both use the same policy.
+
+/// target size of the work unit given to a worker
+static const size_t REPACKUNITBYTES = 64*1024*1024;
+/// target size of a chunk
+static const size_t REPACKCHUNKBYTES = 1024*1024;
+/// rows read and written at once by a worker, rounded to whole chunks
+static const size_t REPACKSLABBYTES = 64*1024*1024;
+
+struct RepackOptions
+{
+    int nworkers;
+    size_t chunk_bytes, unit_bytes;
+    int deflate_level;
+    bool shuffle, delta;
+};
+
+/// a dataset copied through the workers
+struct RepackDataset
+{
+    std::string path;
+    std::vector<hsize_t> dims, chunks;
+    size_t row_bytes;
+};
+/// rows [row_start, row_start + nrows) of a dataset
+struct RepackPiece
+{
+    size_t idataset;
+    hsize_t row_start, nrows;
+};
+/// pieces written by a worker to one temporary file
+struct RepackUnit
+{
+    std::vector<size_t> pieces;
+    size_t nbytes;
+};
+/// an object or link of the source, in the order visited
+struct RepackObject
+{
+    enum Kind {GROUP, DATASET, COPY, HARDLINK, SOFTLINK, EXTERNALLINK};
+    Kind kind;
+    std::string path, target, target_file;
+    size_t idataset;
+};
+struct RepackPlan
+{
+    std::vector<RepackObject> objects;
+    std::vector<RepackDataset> datasets;
+    std::vector<RepackPiece> pieces;
+    std::vector<RepackUnit> units;
+    /// first path of each object reached by hard links
+    std::map<std::string, std::string> object_paths;
+    const RepackOptions *options;
+};
+
+/// name of the temporary file of a unit
+static std::string _unit_filename(const std::string &output, size_t iunit)
+{
+    return output + ".repack" + std::to_string(iunit);
+}
+
+/// what to undo when the repack fails once the workers have been forked
+struct RepackCleanup
+{
+    /// set in the workers, which leave with _exit and leave cleaning up to the parent
+    bool iworker;
+    /// workers not reaped yet
+    std::vector<pid_t> pids;
+    /// the unit files and the output, named beforehand so that they can be
+    /// removed from a signal handler
+    std::vector<std::string> files;
+};
+static RepackCleanup repack_cleanup = {false, {}, {}};
+
+/// stop the workers so they no longer write units, then remove every file
+/// written so far so that an incomplete output is not mistaken for a repacked
+/// file. Only async-signal-safe calls, as it is also run on SIGABRT.
+static void _repack_cleanup()
+{
+    for (auto &pid:repack_cleanup.pids) kill(pid, SIGKILL);
+    for (auto &pid:repack_cleanup.pids) waitpid(pid, NULL, 0);
+    for (auto &file:repack_cleanup.files) unlink(file.c_str());
+}
+
+/// the wrapper aborts on I/O errors, clean up before the process goes down
+static void _repack_abort_handler(int sig)
+{
+    _repack_cleanup();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void repack_error(const std::string &message)
+{
+    std::cerr << "hdf5wrapper_repack: " << message << std::endl;
+    // a worker must not run the exit handlers of the libraries it shares with the parent
+    if (repack_cleanup.iworker) _exit(1);
+    _repack_cleanup();
+    exit(1);
+}
+
+/// whole trailing dimensions while they fit in chunk_bytes, then as much of the next as fits
+static void _repack_chunks(const std::vector<hsize_t> &dims, size_t elsize, size_t chunk_bytes,
+    std::vector<hsize_t> &chunks)
+{
+    chunks.assign(dims.size(), 1);
+    size_t nbytes = elsize;
+    for (auto i=(int)dims.size()-1;i>=0;i--) {
+        chunks[i] = std::min<hsize_t>(dims[i], std::max<size_t>(chunk_bytes / nbytes, 1));
+        if (chunks[i] < dims[i]) break;
+        nbytes *= dims[i];
+    }
+}
+
+/// unique key of an object of the file
+static std::string _object_key(const H5O_info_t &info)
+{
+#if H5_VERSION_GE(1,12,0)
+    return std::string((const char *)&info.token, sizeof(info.token));
+#else
+    return std::string((const char *)&info.addr, sizeof(info.addr));
+#endif
+}
+
+/// whether a dataset is rewritten with the new policy, other datasets
+/// (scalar, empty or holding variable length data or references) are copied as they are
+static bool _repack_dataset(hid_t dset_id, std::vector<hsize_t> &dims, size_t &elsize)
+{
+    hid_t type_id = H5Dget_type(dset_id);
+    hid_t space_id = H5Dget_space(dset_id);
+    bool irepack = (H5Sget_simple_extent_type(space_id) == H5S_SIMPLE)
+        && H5Tdetect_class(type_id, H5T_VLEN) <= 0 && H5Tdetect_class(type_id, H5T_REFERENCE) <= 0
+        && !(H5Tget_class(type_id) == H5T_STRING && H5Tis_variable_str(type_id) > 0);
+    int rank = H5Sget_simple_extent_ndims(space_id);
+    dims.resize(std::max(rank, 0));
+    if (rank > 0) H5Sget_simple_extent_dims(space_id, dims.data(), NULL);
+    if (rank < 1) irepack = false;
+    for (auto &d:dims) if (d == 0) irepack = false;
+    elsize = H5Tget_size(type_id);
+    H5Sclose(space_id);
+    H5Tclose(type_id);
+    return irepack;
+}
+
+static herr_t _visit_link(hid_t group_id, const char *name, const H5L_info_t *info, void *op_data)
+{
+    RepackPlan &plan = *(RepackPlan *)op_data;
+    RepackObject object;
+    object.path = std::string("/") + name;
+    object.idataset = 0;
+    if (info->type == H5L_TYPE_SOFT || info->type == H5L_TYPE_EXTERNAL) {
+        std::vector<char> val(info->u.val_size);
+        H5Lget_val(group_id, name, val.data(), val.size(), H5P_DEFAULT);
+        if (info->type == H5L_TYPE_SOFT) {
+            object.kind = RepackObject::SOFTLINK;
+            object.target = val.data();
+        }
+        else {
+            unsigned flags;
+            const char *filename, *objname;
+            H5Lunpack_elink_val(val.data(), val.size(), &flags, &filename, &objname);
+            object.kind = RepackObject::EXTERNALLINK;
+            object.target_file = filename;
+            object.target = objname;
+        }
+        plan.objects.push_back(object);
+        return 0;
+    }
+    if (info->type != H5L_TYPE_HARD) {
+        std::cerr << "hdf5wrapper_repack: skipping user defined link " << object.path << std::endl;
+        return 0;
+    }
+
+    H5O_info_t object_info;
+#if H5_VERSION_GE(1,12,0)
+    H5Oget_info_by_name(group_id, name, &object_info, H5O_INFO_BASIC, H5P_DEFAULT);
+#else
+    H5Oget_info_by_name(group_id, name, &object_info, H5P_DEFAULT);
+#endif
+    std::string key = _object_key(object_info);
+    auto it = plan.object_paths.find(key);
+    if (it != plan.object_paths.end()) {
+        object.kind = RepackObject::HARDLINK;
+        object.target = it->second;
+        plan.objects.push_back(object);
+        return 0;
+    }
+    plan.object_paths[key] = object.path;
+
+    if (object_info.type == H5O_TYPE_GROUP) object.kind = RepackObject::GROUP;
+    else if (object_info.type == H5O_TYPE_DATASET) {
+        RepackDataset dataset;
+        size_t elsize;
+        hid_t dset_id = H5Dopen(group_id, name, H5P_DEFAULT);
+        bool irepack = _repack_dataset(dset_id, dataset.dims, elsize);
+        H5Dclose(dset_id);
+        if (irepack) {
+            dataset.path = object.path;
+            _repack_chunks(dataset.dims, elsize, plan.options->chunk_bytes, dataset.chunks);
+            dataset.row_bytes = elsize;
+            for (size_t i=1;i<dataset.dims.size();i++) dataset.row_bytes *= dataset.dims[i];
+            object.kind = RepackObject::DATASET;
+            object.idataset = plan.datasets.size();
+            plan.datasets.push_back(dataset);
+        }
+        else object.kind = RepackObject::COPY;
+    }
+    else object.kind = RepackObject::COPY;
+    plan.objects.push_back(object);
+    return 0;
+}
+
+/// cut the datasets into pieces of whole chunks and gather them into units,
+/// largest first so the last units handed out are the small ones
+static void _plan_units(RepackPlan &plan)
+{
+    size_t unit_bytes = plan.options->unit_bytes;
+    for (size_t i=0;i<plan.datasets.size();i++) {
+        RepackDataset &dataset = plan.datasets[i];
+        hsize_t rows = std::max<hsize_t>(unit_bytes / dataset.row_bytes / dataset.chunks[0], 1) * dataset.chunks[0];
+        for (hsize_t row=0; row<dataset.dims[0]; row+=rows) {
+            RepackPiece piece = {i, row, std::min(rows, dataset.dims[0] - row)};
+            plan.pieces.push_back(piece);
+        }
+    }
+    std::vector<size_t> order(plan.pieces.size());
+    for (size_t i=0;i<order.size();i++) order[i] = i;
+    auto piece_bytes = [&plan](size_t ipiece) {
+        const RepackPiece &piece = plan.pieces[ipiece];
+        return piece.nrows * plan.datasets[piece.idataset].row_bytes;
+    };
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {return piece_bytes(a) > piece_bytes(b);});
+    RepackUnit unit;
+    unit.nbytes = 0;
+    for (auto &ipiece:order) {
+        if (unit.pieces.size() > 0 && unit.nbytes + piece_bytes(ipiece) > unit_bytes) {
+            plan.units.push_back(unit);
+            unit.pieces.clear();
+            unit.nbytes = 0;
+        }
+        unit.pieces.push_back(ipiece);
+        unit.nbytes += piece_bytes(ipiece);
+    }
+    if (unit.pieces.size() > 0) plan.units.push_back(unit);
+}
+
+/// template of a dataset with the new policy, the same in the workers and in the
+/// output so that the chunks written by the workers can be copied as they are
+static DatasetTemplate _repack_template(H5OutputFile &out, const RepackDataset &dataset,
+    hid_t filetype_id, hid_t src_dcpl_id, const RepackOptions &options)
+{
+    size_t elsize = H5Tget_size(filetype_id);
+    bool idelta = options.delta && H5Tget_class(filetype_id) == H5T_INTEGER && (elsize == 4 || elsize == 8);
+    DatasetTemplate tmpl = out.create_dataset_template(filetype_id, dataset.dims, dataset.chunks,
+        idelta ? 0 : options.deflate_level, idelta ? false : options.shuffle, H5D_CHUNKED,
+        false, false, false, false);
+    if (idelta) {
+        hdf5_set_delta_filter(tmpl.dcpl_id);
+        if (options.deflate_level > 0) H5Pset_deflate(tmpl.dcpl_id, options.deflate_level);
+    }
+    H5D_fill_value_t fill;
+    H5Pfill_value_defined(src_dcpl_id, &fill);
+    if (fill == H5D_FILL_VALUE_USER_DEFINED) {
+        std::vector<char> value(elsize);
+        H5Pget_fill_value(src_dcpl_id, filetype_id, value.data());
+        H5Pset_fill_value(tmpl.dcpl_id, filetype_id, value.data());
+    }
+    return tmpl;
+}
+
+static herr_t _copy_attribute(hid_t loc_id, const char *name, const H5A_info_t *, void *op_data)
+{
+    hid_t dst_id = *(hid_t *)op_data;
+    hid_t attr_id = H5Aopen(loc_id, name, H5P_DEFAULT);
+    hid_t type_id = H5Aget_type(attr_id);
+    hid_t space_id = H5Aget_space(attr_id);
+    if (H5Tdetect_class(type_id, H5T_REFERENCE) > 0) {
+        std::cerr << "hdf5wrapper_repack: skipping reference attribute " << name << std::endl;
+    }
+    else {
+        hssize_t npoints = std::max<hssize_t>(H5Sget_simple_extent_npoints(space_id), 1);
+        std::vector<char> buf(npoints * H5Tget_size(type_id));
+        H5Aread(attr_id, type_id, buf.data());
+        hid_t new_id = H5Acreate(dst_id, name, type_id, space_id, H5P_DEFAULT, H5P_DEFAULT);
+        if (new_id < 0) repack_error(std::string("Failed to create attribute ")+name);
+        H5Awrite(new_id, type_id, buf.data());
+        H5Aclose(new_id);
+        // variable length data read is allocated by HDF5
+        if (H5Tdetect_class(type_id, H5T_VLEN) > 0 || H5Tis_variable_str(type_id) > 0) {
+#if H5_VERSION_GE(1,12,0)
+            H5Treclaim(type_id, space_id, H5P_DEFAULT, buf.data());
+#else
+            H5Dvlen_reclaim(type_id, space_id, H5P_DEFAULT, buf.data());
+#endif
+        }
+    }
+    H5Sclose(space_id);
+    H5Tclose(type_id);
+    H5Aclose(attr_id);
+    return 0;
+}
+
+static void _copy_attributes(hid_t src_id, hid_t dst_id)
+{
+    H5Aiterate(src_id, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, _copy_attribute, &dst_id);
+}
+
+/// decode the pieces of a unit and write them with the new policy to the unit's file
+static void _write_unit(const RepackPlan &plan, size_t iunit, hid_t src_id, const std::string &output)
+{
+    H5OutputFile out;
+    out.create(_unit_filename(output, iunit));
+    std::vector<char> buf;
+    for (auto &ipiece:plan.units[iunit].pieces) {
+        const RepackPiece &piece = plan.pieces[ipiece];
+        const RepackDataset &dataset = plan.datasets[piece.idataset];
+        int rank = dataset.dims.size();
+        hid_t src_dset_id = H5Dopen(src_id, dataset.path.c_str(), H5P_DEFAULT);
+        hid_t filetype_id = H5Dget_type(src_dset_id);
+        hid_t src_dcpl_id = H5Dget_create_plist(src_dset_id);
+        DatasetTemplate tmpl = _repack_template(out, dataset, filetype_id, src_dcpl_id, *plan.options);
+        hid_t dset_id = out.create_dataset(std::string("p") + std::to_string(ipiece), tmpl, false);
+
+        // slabs of whole chunks, the datasets in the unit files have the full extent
+        // so that the offsets of the chunks are those of the output
+        hsize_t slab_rows = std::max<hsize_t>(REPACKSLABBYTES / dataset.row_bytes / dataset.chunks[0], 1) * dataset.chunks[0];
+        std::vector<hsize_t> start(rank, 0), count(dataset.dims);
+        for (hsize_t row=piece.row_start; row<piece.row_start+piece.nrows; row+=slab_rows) {
+            start[0] = row;
+            count[0] = std::min(slab_rows, piece.row_start + piece.nrows - row);
+            hsize_t npoints = count[0] * (dataset.row_bytes / H5Tget_size(filetype_id));
+            buf.resize(count[0] * dataset.row_bytes);
+            hid_t memspace_id = H5Screate_simple(1, &npoints, NULL);
+            hid_t src_space_id = H5Dget_space(src_dset_id);
+            hid_t dst_space_id = H5Dget_space(dset_id);
+            H5Sselect_hyperslab(src_space_id, H5S_SELECT_SET, start.data(), NULL, count.data(), NULL);
+            H5Sselect_hyperslab(dst_space_id, H5S_SELECT_SET, start.data(), NULL, count.data(), NULL);
+            if (H5Dread(src_dset_id, filetype_id, memspace_id, src_space_id, H5P_DEFAULT, buf.data()) < 0)
+                repack_error(std::string("Failed to read dataset ")+dataset.path);
+            if (H5Dwrite(dset_id, filetype_id, memspace_id, dst_space_id, H5P_DEFAULT, buf.data()) < 0)
+                repack_error(std::string("Failed to write dataset ")+dataset.path);
+            H5Sclose(dst_space_id);
+            H5Sclose(src_space_id);
+            H5Sclose(memspace_id);
+        }
+        H5Dclose(dset_id);
+        H5Pclose(src_dcpl_id);
+        H5Tclose(filetype_id);
+        H5Dclose(src_dset_id);
+    }
+    out.close();
+}
+
+/// copy the compressed chunks of a finished unit into the output
+static void _assemble_unit(const RepackPlan &plan, size_t iunit, hid_t dst_id, const std::string &output)
+{
+    std::string filename = _unit_filename(output, iunit);
+    hid_t unit_id = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (unit_id < 0) repack_error(std::string("Failed to open ")+filename);
+    std::vector<char> buf;
+    for (auto &ipiece:plan.units[iunit].pieces) {
+        const RepackPiece &piece = plan.pieces[ipiece];
+        const RepackDataset &dataset = plan.datasets[piece.idataset];
+        int rank = dataset.dims.size();
+        hid_t src_dset_id = H5Dopen(unit_id, (std::string("p") + std::to_string(ipiece)).c_str(), H5P_DEFAULT);
+        hid_t dst_dset_id = H5Dopen(dst_id, dataset.path.c_str(), H5P_DEFAULT);
+        if (src_dset_id < 0 || dst_dset_id < 0) repack_error(std::string("Failed to open dataset ")+dataset.path);
+
+        // every chunk of the rows of the piece
+        std::vector<hsize_t> nchunks_dim(rank), offset(rank);
+        hsize_t first_chunk = piece.row_start / dataset.chunks[0], nchunks = 1;
+        nchunks_dim[0] = (piece.nrows + dataset.chunks[0] - 1) / dataset.chunks[0];
+        for (auto i=1;i<rank;i++) nchunks_dim[i] = (dataset.dims[i] + dataset.chunks[i] - 1) / dataset.chunks[i];
+        for (auto &n:nchunks_dim) nchunks *= n;
+        for (hsize_t ichunk=0; ichunk<nchunks; ichunk++) {
+            hsize_t index = ichunk;
+            for (auto i=rank-1;i>=0;i--) {
+                offset[i] = (index % nchunks_dim[i] + (i == 0 ? first_chunk : 0)) * dataset.chunks[i];
+                index /= nchunks_dim[i];
+            }
+            hsize_t nbytes;
+            uint32_t filter_mask;
+            if (H5Dget_chunk_storage_size(src_dset_id, offset.data(), &nbytes) < 0)
+                repack_error(std::string("Missing chunk of dataset ")+dataset.path);
+            buf.resize(nbytes);
+            if (H5Dread_chunk(src_dset_id, H5P_DEFAULT, offset.data(), &filter_mask, buf.data()) < 0
+                || H5Dwrite_chunk(dst_dset_id, H5P_DEFAULT, filter_mask, offset.data(), nbytes, buf.data()) < 0)
+                repack_error(std::string("Failed to copy chunk of dataset ")+dataset.path);
+        }
+        H5Dclose(dst_dset_id);
+        H5Dclose(src_dset_id);
+    }
+    H5Fclose(unit_id);
+    unlink(filename.c_str());
+}
+
+/// create the groups, links, attributes and empty datasets of the output
+static void _build_output(const RepackPlan &plan, H5OutputFile &out, hid_t src_id)
+{
+    hid_t dst_id = out.get_file_id();
+    hid_t root_id = H5Gopen(src_id, "/", H5P_DEFAULT), dst_root_id = H5Gopen(dst_id, "/", H5P_DEFAULT);
+    _copy_attributes(root_id, dst_root_id);
+    H5Gclose(dst_root_id);
+    H5Gclose(root_id);
+    for (auto &object:plan.objects) {
+        const char *path = object.path.c_str();
+        herr_t ret = 0;
+        if (object.kind == RepackObject::GROUP) {
+            hid_t src_group_id = H5Gopen(src_id, path, H5P_DEFAULT);
+            hid_t group_id = H5Gcreate(dst_id, path, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+            if (group_id < 0) repack_error(std::string("Failed to create group ")+object.path);
+            _copy_attributes(src_group_id, group_id);
+            H5Gclose(group_id);
+            H5Gclose(src_group_id);
+        }
+        else if (object.kind == RepackObject::DATASET) {
+            const RepackDataset &dataset = plan.datasets[object.idataset];
+            hid_t src_dset_id = H5Dopen(src_id, path, H5P_DEFAULT);
+            hid_t filetype_id = H5Dget_type(src_dset_id);
+            hid_t src_dcpl_id = H5Dget_create_plist(src_dset_id);
+            DatasetTemplate tmpl = _repack_template(out, dataset, filetype_id, src_dcpl_id, *plan.options);
+            hid_t dset_id = out.create_dataset(object.path, tmpl, false);
+            _copy_attributes(src_dset_id, dset_id);
+            H5Dclose(dset_id);
+            H5Pclose(src_dcpl_id);
+            H5Tclose(filetype_id);
+            H5Dclose(src_dset_id);
+        }
+        else if (object.kind == RepackObject::COPY) {
+            ret = H5Ocopy(src_id, path, dst_id, path, H5P_DEFAULT, H5P_DEFAULT);
+        }
+        else if (object.kind == RepackObject::HARDLINK) {
+            ret = H5Lcreate_hard(dst_id, object.target.c_str(), dst_id, path, H5P_DEFAULT, H5P_DEFAULT);
+        }
+        else if (object.kind == RepackObject::SOFTLINK) {
+            ret = H5Lcreate_soft(object.target.c_str(), dst_id, path, H5P_DEFAULT, H5P_DEFAULT);
+        }
+        else if (object.kind == RepackObject::EXTERNALLINK) {
+            ret = H5Lcreate_external(object.target_file.c_str(), object.target.c_str(), dst_id, path, H5P_DEFAULT, H5P_DEFAULT);
+        }
+        if (ret < 0) repack_error(std::string("Failed to copy ")+object.path);
+    }
+}
+
+static void _usage()
+{
+    std::cerr << "usage: hdf5wrapper_repack [options] input.h5 output.h5\n"
+        "  -j N      number of worker processes (default: number of cores)\n"
+        "  -c BYTES  target size of a chunk (default 1048576)\n"
+        "  -z LEVEL  deflate level, 0 for none (default 4)\n"
+        "  -s        shuffle the bytes of the elements before deflate\n"
+        "  -d        delta filter for 32 and 64 bit integer datasets, the output\n"
+        "            can then only be read through the wrapper, which registers the\n"
+        "            filter, and not by h5dump, h5py or other HDF5 tools\n"
+        "  -u BYTES  target size of the work given to a worker at a time (default 67108864)\n";
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    RepackOptions options;
+    options.nworkers = std::max<long>(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    options.chunk_bytes = REPACKCHUNKBYTES;
+    options.unit_bytes = REPACKUNITBYTES;
+    options.deflate_level = 4;
+    options.shuffle = options.delta = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:c:z:sdu:")) != -1) {
+        if (opt == 'j') options.nworkers = std::max(atoi(optarg), 1);
+        else if (opt == 'c') options.chunk_bytes = std::max(atoll(optarg), 1LL);
+        else if (opt == 'z') options.deflate_level = atoi(optarg);
+        else if (opt == 's') options.shuffle = true;
+        else if (opt == 'd') options.delta = true;
+        else if (opt == 'u') options.unit_bytes = std::max(atoll(optarg), 1LL);
+        else _usage();
+    }
+    if (argc - optind != 2) _usage();
+    std::string input = argv[optind], output = argv[optind + 1];
+    auto time_start = std::chrono::steady_clock::now();
+
+    // registers the wrapper's filters, inherited by the workers
+    H5OutputFile out;
+    RepackPlan plan;
+    plan.options = &options;
+    hid_t src_id = H5Fopen(input.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (src_id < 0) repack_error(std::string("Failed to open ")+input);
+    // links back to the root group become hard links
+    H5O_info_t root_info;
+#if H5_VERSION_GE(1,12,0)
+    H5Oget_info(src_id, &root_info, H5O_INFO_BASIC);
+#else
+    H5Oget_info(src_id, &root_info);
+#endif
+    plan.object_paths[_object_key(root_info)] = "/";
+    H5Lvisit(src_id, H5_INDEX_NAME, H5_ITER_INC, _visit_link, &plan);
+    H5Fclose(src_id);
+    _plan_units(plan);
+
+    // the workers take the units in turn through a counter in shared memory
+    std::atomic<long long> *next_unit = (std::atomic<long long> *)mmap(NULL, sizeof(std::atomic<long long>),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (next_unit == MAP_FAILED) repack_error("Failed to map shared memory");
+    new (next_unit) std::atomic<long long>(0);
+    int nworkers = std::min<size_t>(options.nworkers, std::max<size_t>(plan.units.size(), 1));
+    std::vector<int> fds(nworkers);
+    for (size_t iunit=0;iunit<plan.units.size();iunit++) repack_cleanup.files.push_back(_unit_filename(output, iunit));
+    repack_cleanup.files.push_back(output);
+    signal(SIGABRT, _repack_abort_handler);
+    for (auto iworker=0;iworker<nworkers;iworker++) {
+        int pipefd[2];
+        if (pipe(pipefd) != 0) repack_error("Failed to create pipe");
+        pid_t pid = fork();
+        if (pid < 0) repack_error("Failed to fork worker");
+        if (pid == 0) {
+            repack_cleanup.iworker = true;
+            signal(SIGABRT, SIG_DFL);
+            ::close(pipefd[0]);
+            for (auto i=0;i<iworker;i++) ::close(fds[i]);
+            try {
+                hid_t worker_src_id = H5Fopen(input.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+                if (worker_src_id < 0) repack_error(std::string("Failed to open ")+input);
+                long long iunit;
+                while ((iunit = next_unit->fetch_add(1)) < (long long)plan.units.size()) {
+                    _write_unit(plan, iunit, worker_src_id, output);
+                    if (write(pipefd[1], &iunit, sizeof(iunit)) != sizeof(iunit)) _exit(1);
+                }
+                H5Fclose(worker_src_id);
+            }
+            catch (std::exception &e) {
+                repack_error(e.what());
+            }
+            ::close(pipefd[1]);
+            _exit(0);
+        }
+        repack_cleanup.pids.push_back(pid);
+        ::close(pipefd[1]);
+        fds[iworker] = pipefd[0];
+    }
+
+    // build the output while the workers run, then copy in each unit as it is finished
+    size_t nassembled = 0;
+    try {
+        out.create(output);
+        src_id = H5Fopen(input.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+        _build_output(plan, out, src_id);
+        H5Fclose(src_id);
+        std::vector<struct pollfd> pfds(nworkers);
+        for (auto i=0;i<nworkers;i++) {
+            pfds[i].fd = fds[i];
+            pfds[i].events = POLLIN;
+        }
+        int nopen = nworkers;
+        while (nopen > 0) {
+            if (poll(pfds.data(), pfds.size(), -1) < 0) continue;
+            for (auto &pfd:pfds) {
+                if (pfd.fd < 0 || pfd.revents == 0) continue;
+                long long iunit;
+                if (read(pfd.fd, &iunit, sizeof(iunit)) == sizeof(iunit)) {
+                    _assemble_unit(plan, iunit, out.get_file_id(), output);
+                    nassembled++;
+                }
+                else {
+                    ::close(pfd.fd);
+                    pfd.fd = -1;
+                    nopen--;
+                }
+            }
+        }
+    }
+    catch (std::exception &e) {
+        repack_error(e.what());
+    }
+    bool ifailed = false;
+    for (auto &pid:repack_cleanup.pids) {
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ifailed = true;
+    }
+    repack_cleanup.pids.clear();
+    munmap(next_unit, sizeof(std::atomic<long long>));
+    out.close();
+    if (ifailed || nassembled != plan.units.size()) repack_error("A worker failed, the output is incomplete");
+    signal(SIGABRT, SIG_DFL);
+    repack_cleanup.files.clear();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count();
+    std::cout << "repacked " << plan.datasets.size() << " datasets in " << plan.units.size()
+        << " units with " << nworkers << " workers in " << seconds << " s" << std::endl;
+    return 0;
+}